@@ -0,0 +1,167 @@
+// конкуренция за выдачу соединений пула
+// lock-free стек слаба против прежних std::list ready_/active_ под мутексом
+// capstomp_slab_bench [потоков] [операций на поток]
+
+#include "src/slab.hpp"
+
+#include <list>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+// узел повторяет интерфейс соединения для slab_stack
+class node
+{
+    std::atomic<std::uint32_t> next_{};
+    std::size_t index_{};
+
+public:
+    explicit node(std::size_t index) noexcept
+        : index_(index)
+    {   }
+
+    void set_next(std::uint32_t next) noexcept
+    {
+        next_.store(next, std::memory_order_relaxed);
+    }
+
+    std::uint32_t next() const noexcept
+    {
+        return next_.load(std::memory_order_relaxed);
+    }
+
+    std::size_t index() const noexcept
+    {
+        return index_;
+    }
+};
+
+// как было до слаба: соединения живут в std::list пула
+// get переносит первое готовое в начало active_, release возвращает в ready_
+// каждый вызов берет мутекс пула, элемент помнит свой итератор
+class list_pool
+{
+public:
+    struct item;
+    using list_type = std::list<item>;
+
+    struct item
+    {
+        list_type::iterator self{};
+    };
+
+private:
+    std::mutex mutex_{};
+    list_type active_{};
+    list_type ready_{};
+    std::size_t pool_sockets_{};
+
+public:
+    explicit list_pool(std::size_t size)
+        : pool_sockets_(size)
+    {
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            ready_.emplace_front();
+            ready_.front().self = ready_.begin();
+        }
+    }
+
+    item* get()
+    {
+        std::lock_guard<std::mutex> l(mutex_);
+        auto i = ready_.begin();
+        if (i == ready_.end())
+            return nullptr;
+
+        active_.splice(active_.begin(), ready_, i);
+        auto& conn = active_.front();
+        conn.self = active_.begin();
+        return &conn;
+    }
+
+    void release(item* conn)
+    {
+        std::lock_guard<std::mutex> l(mutex_);
+        if (ready_.size() < pool_sockets_)
+        {
+            ready_.splice(ready_.begin(), active_, conn->self);
+            ready_.front().self = ready_.begin();
+        }
+    }
+};
+
+template<class F>
+double run(std::size_t threads, std::size_t ops, F fn)
+{
+    std::vector<std::thread> list;
+    list.reserve(threads);
+
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t t = 0; t < threads; ++t)
+        list.emplace_back([&]{
+            for (std::size_t i = 0; i < ops; ++i)
+                fn();
+        });
+
+    for (auto& t : list)
+        t.join();
+
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    // пар get/release в секунду
+    return static_cast<double>(threads * ops) / elapsed.count();
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    auto threads = static_cast<std::size_t>(std::thread::hardware_concurrency());
+    if (argc > 1)
+        threads = static_cast<std::size_t>(std::strtoul(argv[1], nullptr, 10));
+    std::size_t ops = 1000000u;
+    if (argc > 2)
+        ops = static_cast<std::size_t>(std::strtoul(argv[2], nullptr, 10));
+    if (!threads || !ops)
+    {
+        std::fprintf(stderr, "usage: %s [threads] [ops]\n", argv[0]);
+        return 1;
+    }
+
+    // соединений больше чем потоков, как в пуле с запасом
+    auto size = threads * 2;
+
+    capst::slab<node> slab;
+    capst::slab_stack<node> ready(slab);
+    for (std::size_t i = 0; i < size; ++i)
+        ready.push(slab.emplace());
+
+    list_pool locked(size);
+
+    std::printf("threads=%zu ops=%zu\n", threads, ops);
+
+    for (std::size_t n = 1; n <= threads; n *= 2)
+    {
+        auto lock_free = run(n, ops, [&]{
+            if (auto c = ready.pop())
+                ready.push(c->index());
+        });
+
+        auto mutex = run(n, ops, [&]{
+            if (auto c = locked.get())
+                locked.release(c);
+        });
+
+        std::printf("%3zu threads: slab_stack %12.0f op/s, std::list %12.0f op/s\n",
+            n, lock_free, mutex);
+    }
+
+    return 0;
+}
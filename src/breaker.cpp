@@ -0,0 +1,117 @@
+#include "breaker.hpp"
+#include "journal.hpp"
+#include "conf.hpp"
+
+#include <chrono>
+
+using namespace std::literals;
+
+namespace capst {
+
+std::int64_t breaker::now() noexcept
+{
+    using std::chrono::duration_cast;
+    using std::chrono::milliseconds;
+    return duration_cast<milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool breaker::allow() noexcept
+{
+    if (state_.load(std::memory_order_acquire) == closed)
+        return true;
+
+    // автомат отключен на ходу
+    if (!conf::breaker_failures())
+        return true;
+
+    // после паузы пропускаем только одного
+    int s = open;
+    if ((until_.load(std::memory_order_relaxed) <= now()) &&
+        state_.compare_exchange_strong(s, half_open))
+    {
+        capst_journal.cout([]{
+            return "breaker: probe";
+        });
+        return true;
+    }
+
+    reject_count_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void breaker::success() noexcept
+{
+    fail_.store(0, std::memory_order_relaxed);
+
+    if (state_.exchange(closed) != closed)
+    {
+        capst_journal.cout([]{
+            return "breaker: closed";
+        });
+    }
+}
+
+void breaker::failure() noexcept
+{
+    auto fail = fail_.fetch_add(1) + 1;
+
+    // неудачная проба размыкает снова
+    auto s = state_.load();
+    if (s == half_open)
+        trip(half_open, fail);
+    else if (s == closed)
+    {
+        auto limit = conf::breaker_failures();
+        if (limit && (fail >= limit))
+            trip(closed, fail);
+    }
+}
+
+void breaker::cancel() noexcept
+{
+    int s = half_open;
+    state_.compare_exchange_strong(s, open);
+}
+
+void breaker::trip(int from, std::size_t fail) noexcept
+{
+    auto cooldown = static_cast<std::int64_t>(conf::breaker_cooldown());
+    until_.store(now() + cooldown, std::memory_order_relaxed);
+
+    // размыкает только один из потоков
+    if (!state_.compare_exchange_strong(from, open))
+        return;
+
+    trip_count_.fetch_add(1, std::memory_order_relaxed);
+
+    capst_journal.cerr([&]{
+        std::string text;
+        text.reserve(64);
+        text += "breaker: open after "sv;
+        text += std::to_string(fail);
+        text += " failures for "sv;
+        text += std::to_string(cooldown);
+        text += "ms"sv;
+        return text;
+    });
+}
+
+std::string breaker::json() const
+{
+    constexpr std::string_view name[] = { "closed"sv, "open"sv, "half-open"sv };
+
+    std::string rc;
+    rc.reserve(96);
+
+    rc += '{';
+        rc += "\"state\":\""sv; rc += name[state()]; rc += '"';
+        rc += ",\"fail\":"sv; rc += std::to_string(fail_.load());
+        rc += ",\"trip\":"sv; rc += std::to_string(trip_count_.load());
+        rc += ",\"reject\":"sv; rc += std::to_string(reject_count_.load());
+    rc += '}';
+
+    return rc;
+}
+
+} // namespace capst
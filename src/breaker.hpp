@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <cstdint>
+
+namespace capst {
+
+// автомат защиты подключений пула
+// после серии ошибок подключения вызовы сразу получают отказ,
+// по истечении паузы пропускается одно пробное подключение
+class breaker
+{
+public:
+    enum state_type
+    {
+        closed,
+        open,
+        half_open
+    };
+
+private:
+    std::atomic<int> state_{closed};
+    // ошибки подряд
+    std::atomic<std::size_t> fail_{};
+    // пауза до этого момента, мс
+    std::atomic<std::int64_t> until_{};
+    // число размыканий
+    std::atomic<std::size_t> trip_count_{};
+    // отказы без попытки подключения
+    std::atomic<std::size_t> reject_count_{};
+
+    static std::int64_t now() noexcept;
+
+    void trip(int from, std::size_t fail) noexcept;
+
+public:
+    breaker() = default;
+
+    // можно ли подключаться
+    bool allow() noexcept;
+
+    void success() noexcept;
+
+    void failure() noexcept;
+
+    // попытка прервана сроком вызова, брокер не виноват
+    // прерванная проба отдается следующему вызову
+    void cancel() noexcept;
+
+    state_type state() const noexcept
+    {
+        return static_cast<state_type>(state_.load(std::memory_order_relaxed));
+    }
+
+    std::string json() const;
+};
+
+} // namespace capst
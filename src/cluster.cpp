@@ -0,0 +1,237 @@
+#include "cluster.hpp"
+#include "journal.hpp"
+
+#include <random>
+#include <vector>
+#include <charconv>
+#include <stdexcept>
+#include <algorithm>
+
+using namespace std::literals;
+
+namespace capst {
+
+// начальная и максимальная пауза исключения узла, мс
+constexpr auto eject_min = std::int64_t{500};
+constexpr auto eject_max = std::int64_t{30000};
+
+std::int64_t cluster::now() noexcept
+{
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+    return duration_cast<microseconds>(
+        clock::now().time_since_epoch()).count();
+}
+
+std::string cluster::normalize(const std::string& uri, std::string& hosts)
+{
+    hosts.clear();
+
+    auto scheme = uri.find("://"sv);
+    if (scheme == std::string::npos)
+        return uri;
+
+    auto begin = scheme + 3;
+    auto end = uri.find_first_of("/?#"sv, begin);
+    if (end == std::string::npos)
+        end = uri.size();
+
+    // пропускаем login:passcode@
+    auto at = uri.rfind('@', end);
+    if ((at != std::string::npos) && (at >= begin))
+        begin = at + 1;
+
+    auto comma = uri.find(',', begin);
+    if ((comma == std::string::npos) || (comma >= end))
+        return uri;
+
+    hosts.assign(uri, begin, end - begin);
+
+    std::string rc;
+    rc.reserve(uri.size());
+    rc.append(uri, 0, comma);
+    rc.append(uri, end, std::string::npos);
+    return rc;
+}
+
+void cluster::assign(std::string_view hosts, int def_port)
+{
+    if (ready_.load(std::memory_order_acquire))
+        return;
+
+    std::lock_guard<std::mutex> l(mutex_);
+
+    if (ready_.load(std::memory_order_relaxed))
+        return;
+
+    std::vector<std::pair<std::string, int>> list;
+    while (!hosts.empty())
+    {
+        auto comma = hosts.find(',');
+        auto h = hosts.substr(0, comma);
+        hosts.remove_prefix((comma == std::string_view::npos) ?
+            hosts.size() : comma + 1);
+
+        auto port = def_port;
+        auto colon = h.rfind(':');
+        // [::1]:61613
+        auto bracket = h.rfind(']');
+        if ((colon != std::string_view::npos) &&
+            ((bracket == std::string_view::npos) || (colon > bracket)))
+        {
+            auto p = h.substr(colon + 1);
+            auto [ptr, ec] = std::from_chars(p.data(), p.data() + p.size(), port);
+            if ((ec != std::errc()) || (ptr != p.data() + p.size()))
+                throw std::runtime_error("bad broker port: " + std::string(h));
+            h = h.substr(0, colon);
+        }
+
+        if (!h.empty() && (h.front() == '[') && (h.back() == ']'))
+            h = h.substr(1, h.size() - 2);
+
+        if (h.empty())
+            throw std::runtime_error("empty broker host");
+
+        list.emplace_back(std::string(h), port);
+    }
+
+    node_ = std::make_unique<node[]>(list.size());
+    for (std::size_t i = 0; i < list.size(); ++i)
+    {
+        node_[i].host = std::move(list[i].first);
+        node_[i].port = list[i].second;
+    }
+    size_ = list.size();
+
+    capst_journal.cout([&]{
+        std::string text;
+        text.reserve(64);
+        text += "cluster: brokers="sv;
+        text += std::to_string(size_);
+        return text;
+    });
+
+    ready_.store(true, std::memory_order_release);
+}
+
+std::size_t cluster::find_healthy(std::size_t i, std::int64_t now) const noexcept
+{
+    for (std::size_t n = 0; n < size_; ++n, i = (i + 1) % size_)
+    {
+        if (healthy(i, now))
+            return i;
+    }
+    return npos;
+}
+
+std::size_t cluster::select() noexcept
+{
+    auto t = now();
+
+    // два случайных работающих узла, берем менее загруженный
+    // нагрузка - задержка квитанций на число открытых соединений
+    thread_local std::minstd_rand rnd{std::random_device{}()};
+    auto a = find_healthy(rnd() % size_, t);
+    if (a == npos)
+    {
+        // все исключены, берем тот что вернется раньше
+        auto rc = std::size_t{};
+        for (std::size_t i = 1; i < size_; ++i)
+        {
+            if (node_[i].eject.load() < node_[rc].eject.load())
+                rc = i;
+        }
+        return rc;
+    }
+
+    auto b = find_healthy(rnd() % size_, t);
+
+    auto score = [&](std::size_t i) {
+        auto& n = node_[i];
+        auto latency = n.latency.load(std::memory_order_relaxed);
+        auto active = n.active.load(std::memory_order_relaxed);
+        return (latency + 1) * static_cast<std::int64_t>(active + 1);
+    };
+
+    return (score(b) < score(a)) ? b : a;
+}
+
+void cluster::connected(std::size_t i, clock::duration logon) noexcept
+{
+    auto& n = node_[i];
+    n.fail.store(0);
+    n.eject.store(0);
+    n.active.fetch_add(1);
+    latency(i, logon);
+}
+
+void cluster::closed(std::size_t i) noexcept
+{
+    node_[i].active.fetch_sub(1);
+}
+
+void cluster::failed(std::size_t i) noexcept
+{
+    auto& n = node_[i];
+    auto fail = n.fail.fetch_add(1) + 1;
+    auto shift = static_cast<int>(std::min(fail - 1, std::size_t{6u}));
+    auto pause = std::min(eject_min << shift, eject_max);
+    n.eject.store(now() + pause * 1000);
+
+    capst_journal.cerr([&]{
+        std::string text;
+        text.reserve(64);
+        text += "cluster: eject "sv;
+        text += n.host;
+        text += ':';
+        text += std::to_string(n.port);
+        text += " for "sv;
+        text += std::to_string(pause);
+        text += "ms"sv;
+        return text;
+    });
+}
+
+void cluster::latency(std::size_t i, clock::duration value) noexcept
+{
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    auto sample = duration_cast<microseconds>(value).count();
+    auto& latency = node_[i].latency;
+    // ewma 1/8, потеря замера при гонке не важна
+    auto prev = latency.load(std::memory_order_relaxed);
+    latency.store(prev ? prev + (sample - prev) / 8 : sample,
+        std::memory_order_relaxed);
+}
+
+std::string cluster::json() const
+{
+    std::string rc;
+    rc.reserve(128);
+
+    auto t = now();
+    auto size = this->size();
+
+    rc += '[';
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        auto& n = node_[i];
+        if (i)
+            rc += ',';
+        rc += '{';
+            rc += "\"host\":\""sv; rc += n.host; rc += '"';
+            rc += ",\"port\":"sv; rc += std::to_string(n.port);
+            rc += ",\"latency\":"sv; rc += std::to_string(n.latency.load());
+            rc += ",\"active\":"sv; rc += std::to_string(n.active.load());
+            rc += ",\"fail\":"sv; rc += std::to_string(n.fail.load());
+            if (!healthy(i, t))
+                rc += ",\"ejected\":true"sv;
+        rc += '}';
+    }
+    rc += ']';
+
+    return rc;
+}
+
+} // namespace capst
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <mutex>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <string_view>
+
+namespace capst {
+
+// узлы кластера брокеров одного пула
+// uri вида stomp://user:pass@h1,h2:61614,h3/vhost#/queue/x
+// btpro::uri разбирает только один адрес,
+// поэтому список узлов вырезается из строки заранее
+class cluster
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    static constexpr auto npos = static_cast<std::size_t>(-1);
+
+    struct node
+    {
+        std::string host{};
+        int port{};
+        // сглаженная задержка квитанций, мкс
+        std::atomic<std::int64_t> latency{};
+        // открытые соединения
+        std::atomic<std::size_t> active{};
+        // ошибки подряд
+        std::atomic<std::size_t> fail{};
+        // узел исключен до этого момента, мкс
+        std::atomic<std::int64_t> eject{};
+    };
+
+private:
+    std::mutex mutex_{};
+    std::atomic<bool> ready_{};
+    std::unique_ptr<node[]> node_{};
+    std::size_t size_{};
+
+    static std::int64_t now() noexcept;
+
+    bool healthy(std::size_t i, std::int64_t now) const noexcept
+    {
+        return node_[i].eject.load(std::memory_order_relaxed) <= now;
+    }
+
+    // первый работающий узел начиная с i
+    std::size_t find_healthy(std::size_t i, std::int64_t now) const noexcept;
+
+public:
+    cluster() = default;
+
+    // вырезать список узлов из uri, вернуть uri с первым узлом
+    // hosts остается пустым если узел один
+    static std::string normalize(const std::string& uri, std::string& hosts);
+
+    // список разбирается один раз на пул
+    void assign(std::string_view hosts, int def_port);
+
+    // 0 если uri содержит один адрес
+    std::size_t size() const noexcept
+    {
+        return ready_.load(std::memory_order_acquire) ? size_ : 0;
+    }
+
+    const node& at(std::size_t i) const noexcept
+    {
+        return node_[i];
+    }
+
+    // выбрать узел для нового подключения
+    std::size_t select() noexcept;
+
+    // подключение установлено, время входа - первый замер задержки
+    void connected(std::size_t i, clock::duration logon) noexcept;
+
+    void closed(std::size_t i) noexcept;
+
+    // исключить узел с нарастающей паузой
+    void failed(std::size_t i) noexcept;
+
+    void latency(std::size_t i, clock::duration value) noexcept;
+
+    std::string json() const;
+};
+
+} // namespace capst
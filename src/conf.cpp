@@ -5,6 +5,8 @@
 #include "mysql.hpp"
 #include <string.h>
 #include <cstdint>
+#include <mutex>
+#include <unordered_map>
 
 namespace capst {
 
@@ -42,6 +44,7 @@ void conf::set_max_pool_count(std::size_t value) noexcept
 void conf::set_max_pool_sockets(std::size_t value) noexcept
 {
     value = std::max(value, max_pool_sockets_min);
+    value = std::min(value, max_pool_sockets_max);
 
     capst_journal.cout([value]{
         std::string text;
@@ -81,6 +84,217 @@ void conf::set_request_limit(std::size_t value) noexcept
     inst().request_limit_ = value;
 }
 
+void conf::set_async_queue_size(std::size_t value) noexcept
+{
+    value = std::max(value, async_queue_size_min);
+
+    capst_journal.cout([value]{
+        std::string text;
+        text += "set async queue size = "sv;
+        text += std::to_string(value);
+        return text;
+    });
+
+    inst().async_queue_size_ = value;
+}
+
+void conf::set_cork_size(std::size_t value) noexcept
+{
+    value = std::max(value, cork_size_min);
+
+    capst_journal.cout([value]{
+        std::string text;
+        text += "set cork size = "sv;
+        text += std::to_string(value);
+        return text;
+    });
+
+    inst().cork_size_ = value;
+}
+
+void conf::set_dns_ttl(std::size_t value) noexcept
+{
+    value = std::max(value, dns_ttl_min);
+
+    capst_journal.cout([value]{
+        std::string text;
+        text += "set dns ttl = "sv;
+        text += std::to_string(value);
+        return text;
+    });
+
+    inst().dns_ttl_ = value;
+}
+
+void conf::set_recycle_time(std::size_t value) noexcept
+{
+    value = std::max(value, recycle_time_min);
+
+    capst_journal.cout([value]{
+        std::string text;
+        text += "set recycle time = "sv;
+        text += std::to_string(value);
+        return text;
+    });
+
+    inst().recycle_time_ = value;
+}
+
+void conf::set_receipt_window(std::size_t value) noexcept
+{
+    value = std::max(value, receipt_window_min);
+    value = std::min(value, receipt_window_max);
+
+    capst_journal.cout([value]{
+        std::string text;
+        text += "set receipt window = "sv;
+        text += std::to_string(value);
+        return text;
+    });
+
+    inst().receipt_window_ = value;
+}
+
+void conf::set_heartbeat(std::size_t value) noexcept
+{
+    capst_journal.cout([value]{
+        std::string text;
+        text += "set heartbeat = "sv;
+        text += std::to_string(value);
+        return text;
+    });
+
+    inst().heartbeat_ = value;
+}
+
+void conf::set_idle_timeout(std::size_t value) noexcept
+{
+    value = std::max(value, idle_timeout_min);
+
+    capst_journal.cout([value]{
+        std::string text;
+        text += "set idle timeout = "sv;
+        text += std::to_string(value);
+        return text;
+    });
+
+    inst().idle_timeout_ = value;
+}
+
+void conf::set_breaker_failures(std::size_t value) noexcept
+{
+    capst_journal.cout([value]{
+        std::string text;
+        text += "set breaker failures = "sv;
+        text += std::to_string(value);
+        return text;
+    });
+
+    inst().breaker_failures_ = value;
+}
+
+void conf::set_breaker_cooldown(std::size_t value) noexcept
+{
+    value = std::max(value, breaker_cooldown_min);
+
+    capst_journal.cout([value]{
+        std::string text;
+        text += "set breaker cooldown = "sv;
+        text += std::to_string(value);
+        return text;
+    });
+
+    inst().breaker_cooldown_ = value;
+}
+
+// поток mysql переходит от сессии к сессии без уведомления udf
+// поэтому срок хранится по CONNECTION_ID(), а не в потоке
+static std::mutex session_deadline_mutex;
+static std::unordered_map<std::uint64_t, std::size_t> session_deadline_value;
+
+std::size_t conf::session_deadline(std::uint64_t id) noexcept
+{
+    if (!id)
+        return std::size_t();
+
+    std::lock_guard<std::mutex> l(session_deadline_mutex);
+    auto i = session_deadline_value.find(id);
+    return (i != session_deadline_value.end()) ? i->second : std::size_t();
+}
+
+void conf::set_session_deadline(std::uint64_t id, std::size_t value)
+{
+    capst_journal.trace([id, value]{
+        std::string text;
+        text += "set session "sv;
+        text += std::to_string(id);
+        text += " deadline = "sv;
+        text += std::to_string(value);
+        return text;
+    });
+
+    std::lock_guard<std::mutex> l(session_deadline_mutex);
+    if (value)
+        session_deadline_value[id] = value;
+    else
+        session_deadline_value.erase(id);
+}
+
+void conf::set_replay_size(std::size_t value) noexcept
+{
+    value = std::max(value, replay_size_min);
+
+    capst_journal.cout([value]{
+        std::string text;
+        text += "set replay size = "sv;
+        text += std::to_string(value);
+        return text;
+    });
+
+    inst().replay_size_ = value;
+}
+
+void conf::set_affinity_lanes(std::size_t value) noexcept
+{
+    value = std::max(value, affinity_lanes_min);
+    value = std::min(value, affinity_lanes_max);
+
+    capst_journal.cout([value]{
+        std::string text;
+        text += "set affinity lanes = "sv;
+        text += std::to_string(value);
+        return text;
+    });
+
+    inst().affinity_lanes_ = value;
+}
+
+void conf::set_stuck_timeout(std::size_t value) noexcept
+{
+    capst_journal.cout([value]{
+        std::string text;
+        text += "set stuck timeout = "sv;
+        text += std::to_string(value);
+        return text;
+    });
+
+    inst().stuck_timeout_ = value;
+}
+
+void conf::set_session_timeout(std::size_t value) noexcept
+{
+    value = std::max(value, session_timeout_min);
+
+    capst_journal.cout([value]{
+        std::string text;
+        text += "set session timeout = "sv;
+        text += std::to_string(value);
+        return text;
+    });
+
+    inst().session_timeout_ = value;
+}
+
 void conf::set_verbose(std::size_t value) noexcept
 {
     value = std::min(value, verbose_max);
@@ -357,6 +571,726 @@ extern "C" long long capstomp_request_limit(UDF_INIT* initid,
 extern "C" void capstomp_request_limit_deinit(UDF_INIT*)
 {   }
 
+extern "C" my_bool capstomp_async_queue_size_init(UDF_INIT* initid,
+    UDF_ARGS* args, char* msg)
+{
+    auto arg_count = args->arg_count;
+    if ((arg_count == 1) && (args->arg_type[0] == INT_RESULT) && args->args[0])
+    {
+        auto new_async_queue_size =
+            *reinterpret_cast<long long*>(args->args[0]);
+        capst::conf::set_async_queue_size(
+            static_cast<std::size_t>(new_async_queue_size));
+
+        initid->ptr =
+            reinterpret_cast<char*>(static_cast<std::intptr_t>(
+                capst::conf::async_queue_size()));
+
+        return my_bool();
+    }
+    else if (arg_count == 0)
+    {
+        initid->ptr =
+            reinterpret_cast<char*>(static_cast<std::intptr_t>(
+                capst::conf::async_queue_size()));
+
+        return my_bool();
+    }
+
+    initid->ptr = nullptr;
+
+    strncpy(msg, "bad args, use capstomp_async_queue_size([count])",
+        MYSQL_ERRMSG_SIZE);
+
+    return 1;
+}
+
+extern "C" long long capstomp_async_queue_size(UDF_INIT* initid,
+    UDF_ARGS*, char* is_null, char* error)
+{
+    auto ptr = initid->ptr;
+    if (ptr)
+    {
+        return static_cast<long long>(
+                reinterpret_cast<std::intptr_t>(ptr));
+    }
+
+    *error = 1;
+    *is_null = 1;
+    return 0;
+}
+
+extern "C" void capstomp_async_queue_size_deinit(UDF_INIT*)
+{   }
+
+extern "C" my_bool capstomp_cork_size_init(UDF_INIT* initid,
+    UDF_ARGS* args, char* msg)
+{
+    auto arg_count = args->arg_count;
+    if ((arg_count == 1) && (args->arg_type[0] == INT_RESULT) && args->args[0])
+    {
+        auto new_cork_size = *reinterpret_cast<long long*>(args->args[0]);
+        capst::conf::set_cork_size(static_cast<std::size_t>(new_cork_size));
+
+        initid->ptr =
+            reinterpret_cast<char*>(static_cast<std::intptr_t>(
+                capst::conf::cork_size()));
+
+        return my_bool();
+    }
+    else if (arg_count == 0)
+    {
+        initid->ptr =
+            reinterpret_cast<char*>(static_cast<std::intptr_t>(
+                capst::conf::cork_size()));
+
+        return my_bool();
+    }
+
+    initid->ptr = nullptr;
+
+    strncpy(msg, "bad args, use capstomp_cork_size([bytes])",
+        MYSQL_ERRMSG_SIZE);
+
+    return 1;
+}
+
+extern "C" long long capstomp_cork_size(UDF_INIT* initid,
+    UDF_ARGS*, char* is_null, char* error)
+{
+    auto ptr = initid->ptr;
+    if (ptr)
+    {
+        return static_cast<long long>(
+                reinterpret_cast<std::intptr_t>(ptr));
+    }
+
+    *error = 1;
+    *is_null = 1;
+    return 0;
+}
+
+extern "C" void capstomp_cork_size_deinit(UDF_INIT*)
+{   }
+
+extern "C" my_bool capstomp_dns_ttl_init(UDF_INIT* initid,
+    UDF_ARGS* args, char* msg)
+{
+    auto arg_count = args->arg_count;
+    if ((arg_count == 1) && (args->arg_type[0] == INT_RESULT) && args->args[0])
+    {
+        auto new_dns_ttl = *reinterpret_cast<long long*>(args->args[0]);
+        capst::conf::set_dns_ttl(static_cast<std::size_t>(new_dns_ttl));
+
+        initid->ptr =
+            reinterpret_cast<char*>(static_cast<std::intptr_t>(
+                capst::conf::dns_ttl()));
+
+        return my_bool();
+    }
+    else if (arg_count == 0)
+    {
+        initid->ptr =
+            reinterpret_cast<char*>(static_cast<std::intptr_t>(
+                capst::conf::dns_ttl()));
+
+        return my_bool();
+    }
+
+    initid->ptr = nullptr;
+
+    strncpy(msg, "bad args, use capstomp_dns_ttl([seconds])",
+        MYSQL_ERRMSG_SIZE);
+
+    return 1;
+}
+
+extern "C" long long capstomp_dns_ttl(UDF_INIT* initid,
+    UDF_ARGS*, char* is_null, char* error)
+{
+    auto ptr = initid->ptr;
+    if (ptr)
+    {
+        return static_cast<long long>(
+                reinterpret_cast<std::intptr_t>(ptr));
+    }
+
+    *error = 1;
+    *is_null = 1;
+    return 0;
+}
+
+extern "C" void capstomp_dns_ttl_deinit(UDF_INIT*)
+{   }
+
+extern "C" my_bool capstomp_recycle_time_init(UDF_INIT* initid,
+    UDF_ARGS* args, char* msg)
+{
+    auto arg_count = args->arg_count;
+    if ((arg_count == 1) && (args->arg_type[0] == INT_RESULT) && args->args[0])
+    {
+        auto new_recycle_time = *reinterpret_cast<long long*>(args->args[0]);
+        capst::conf::set_recycle_time(static_cast<std::size_t>(new_recycle_time));
+
+        initid->ptr =
+            reinterpret_cast<char*>(static_cast<std::intptr_t>(
+                capst::conf::recycle_time()));
+
+        return my_bool();
+    }
+    else if (arg_count == 0)
+    {
+        initid->ptr =
+            reinterpret_cast<char*>(static_cast<std::intptr_t>(
+                capst::conf::recycle_time()));
+
+        return my_bool();
+    }
+
+    initid->ptr = nullptr;
+
+    strncpy(msg, "bad args, use capstomp_recycle_time([seconds])",
+        MYSQL_ERRMSG_SIZE);
+
+    return 1;
+}
+
+extern "C" long long capstomp_recycle_time(UDF_INIT* initid,
+    UDF_ARGS*, char* is_null, char* error)
+{
+    auto ptr = initid->ptr;
+    if (ptr)
+    {
+        return static_cast<long long>(
+                reinterpret_cast<std::intptr_t>(ptr));
+    }
+
+    *error = 1;
+    *is_null = 1;
+    return 0;
+}
+
+extern "C" void capstomp_recycle_time_deinit(UDF_INIT*)
+{   }
+
+extern "C" my_bool capstomp_receipt_window_init(UDF_INIT* initid,
+    UDF_ARGS* args, char* msg)
+{
+    auto arg_count = args->arg_count;
+    if ((arg_count == 1) && (args->arg_type[0] == INT_RESULT) && args->args[0])
+    {
+        auto new_receipt_window = *reinterpret_cast<long long*>(args->args[0]);
+        capst::conf::set_receipt_window(static_cast<std::size_t>(new_receipt_window));
+
+        initid->ptr =
+            reinterpret_cast<char*>(static_cast<std::intptr_t>(
+                capst::conf::receipt_window()));
+
+        return my_bool();
+    }
+    else if (arg_count == 0)
+    {
+        initid->ptr =
+            reinterpret_cast<char*>(static_cast<std::intptr_t>(
+                capst::conf::receipt_window()));
+
+        return my_bool();
+    }
+
+    initid->ptr = nullptr;
+
+    strncpy(msg, "bad args, use capstomp_receipt_window([count])",
+        MYSQL_ERRMSG_SIZE);
+
+    return 1;
+}
+
+extern "C" long long capstomp_receipt_window(UDF_INIT* initid,
+    UDF_ARGS*, char* is_null, char* error)
+{
+    auto ptr = initid->ptr;
+    if (ptr)
+    {
+        return static_cast<long long>(
+                reinterpret_cast<std::intptr_t>(ptr));
+    }
+
+    *error = 1;
+    *is_null = 1;
+    return 0;
+}
+
+extern "C" void capstomp_receipt_window_deinit(UDF_INIT*)
+{   }
+
+extern "C" my_bool capstomp_heartbeat_init(UDF_INIT* initid,
+    UDF_ARGS* args, char* msg)
+{
+    auto arg_count = args->arg_count;
+    if ((arg_count == 1) && (args->arg_type[0] == INT_RESULT) && args->args[0])
+    {
+        auto new_heartbeat = *reinterpret_cast<long long*>(args->args[0]);
+        capst::conf::set_heartbeat(static_cast<std::size_t>(new_heartbeat));
+
+        initid->ptr =
+            reinterpret_cast<char*>(static_cast<std::intptr_t>(
+                capst::conf::heartbeat()));
+
+        return my_bool();
+    }
+    else if (arg_count == 0)
+    {
+        initid->ptr =
+            reinterpret_cast<char*>(static_cast<std::intptr_t>(
+                capst::conf::heartbeat()));
+
+        return my_bool();
+    }
+
+    initid->ptr = nullptr;
+
+    strncpy(msg, "bad args, use capstomp_heartbeat([ms])",
+        MYSQL_ERRMSG_SIZE);
+
+    return 1;
+}
+
+extern "C" long long capstomp_heartbeat(UDF_INIT* initid,
+    UDF_ARGS*, char* is_null, char* error)
+{
+    auto ptr = initid->ptr;
+    if (ptr)
+    {
+        return static_cast<long long>(
+                reinterpret_cast<std::intptr_t>(ptr));
+    }
+
+    *error = 1;
+    *is_null = 1;
+    return 0;
+}
+
+extern "C" void capstomp_heartbeat_deinit(UDF_INIT*)
+{   }
+
+extern "C" my_bool capstomp_idle_timeout_init(UDF_INIT* initid,
+    UDF_ARGS* args, char* msg)
+{
+    auto arg_count = args->arg_count;
+    if ((arg_count == 1) && (args->arg_type[0] == INT_RESULT) && args->args[0])
+    {
+        auto new_idle_timeout = *reinterpret_cast<long long*>(args->args[0]);
+        capst::conf::set_idle_timeout(static_cast<std::size_t>(new_idle_timeout));
+
+        initid->ptr =
+            reinterpret_cast<char*>(static_cast<std::intptr_t>(
+                capst::conf::idle_timeout()));
+
+        return my_bool();
+    }
+    else if (arg_count == 0)
+    {
+        initid->ptr =
+            reinterpret_cast<char*>(static_cast<std::intptr_t>(
+                capst::conf::idle_timeout()));
+
+        return my_bool();
+    }
+
+    initid->ptr = nullptr;
+
+    strncpy(msg, "bad args, use capstomp_idle_timeout([seconds])",
+        MYSQL_ERRMSG_SIZE);
+
+    return 1;
+}
+
+extern "C" long long capstomp_idle_timeout(UDF_INIT* initid,
+    UDF_ARGS*, char* is_null, char* error)
+{
+    auto ptr = initid->ptr;
+    if (ptr)
+    {
+        return static_cast<long long>(
+                reinterpret_cast<std::intptr_t>(ptr));
+    }
+
+    *error = 1;
+    *is_null = 1;
+    return 0;
+}
+
+extern "C" void capstomp_idle_timeout_deinit(UDF_INIT*)
+{   }
+
+extern "C" my_bool capstomp_breaker_failures_init(UDF_INIT* initid,
+    UDF_ARGS* args, char* msg)
+{
+    auto arg_count = args->arg_count;
+    if ((arg_count == 1) && (args->arg_type[0] == INT_RESULT) && args->args[0])
+    {
+        auto new_breaker_failures = *reinterpret_cast<long long*>(args->args[0]);
+        capst::conf::set_breaker_failures(static_cast<std::size_t>(new_breaker_failures));
+
+        initid->ptr =
+            reinterpret_cast<char*>(static_cast<std::intptr_t>(
+                capst::conf::breaker_failures()));
+
+        return my_bool();
+    }
+    else if (arg_count == 0)
+    {
+        initid->ptr =
+            reinterpret_cast<char*>(static_cast<std::intptr_t>(
+                capst::conf::breaker_failures()));
+
+        return my_bool();
+    }
+
+    initid->ptr = nullptr;
+
+    strncpy(msg, "bad args, use capstomp_breaker_failures([failures])",
+        MYSQL_ERRMSG_SIZE);
+
+    return 1;
+}
+
+extern "C" long long capstomp_breaker_failures(UDF_INIT* initid,
+    UDF_ARGS*, char* is_null, char* error)
+{
+    auto ptr = initid->ptr;
+    if (ptr)
+    {
+        return static_cast<long long>(
+                reinterpret_cast<std::intptr_t>(ptr));
+    }
+
+    *error = 1;
+    *is_null = 1;
+    return 0;
+}
+
+extern "C" void capstomp_breaker_failures_deinit(UDF_INIT*)
+{   }
+
+extern "C" my_bool capstomp_breaker_cooldown_init(UDF_INIT* initid,
+    UDF_ARGS* args, char* msg)
+{
+    auto arg_count = args->arg_count;
+    if ((arg_count == 1) && (args->arg_type[0] == INT_RESULT) && args->args[0])
+    {
+        auto new_breaker_cooldown = *reinterpret_cast<long long*>(args->args[0]);
+        capst::conf::set_breaker_cooldown(static_cast<std::size_t>(new_breaker_cooldown));
+
+        initid->ptr =
+            reinterpret_cast<char*>(static_cast<std::intptr_t>(
+                capst::conf::breaker_cooldown()));
+
+        return my_bool();
+    }
+    else if (arg_count == 0)
+    {
+        initid->ptr =
+            reinterpret_cast<char*>(static_cast<std::intptr_t>(
+                capst::conf::breaker_cooldown()));
+
+        return my_bool();
+    }
+
+    initid->ptr = nullptr;
+
+    strncpy(msg, "bad args, use capstomp_breaker_cooldown([ms])",
+        MYSQL_ERRMSG_SIZE);
+
+    return 1;
+}
+
+extern "C" long long capstomp_breaker_cooldown(UDF_INIT* initid,
+    UDF_ARGS*, char* is_null, char* error)
+{
+    auto ptr = initid->ptr;
+    if (ptr)
+    {
+        return static_cast<long long>(
+                reinterpret_cast<std::intptr_t>(ptr));
+    }
+
+    *error = 1;
+    *is_null = 1;
+    return 0;
+}
+
+extern "C" void capstomp_breaker_cooldown_deinit(UDF_INIT*)
+{   }
+
+//                       0                  1
+// "capstomp_deadline(CONNECTION_ID()[, ms])"
+// CONNECTION_ID() в init может быть еще не вычислен
+// поэтому работа выполняется в основной функции
+extern "C" my_bool capstomp_deadline_init(UDF_INIT* initid,
+    UDF_ARGS* args, char* msg)
+{
+    auto arg_count = args->arg_count;
+    if ((arg_count < 1) || (arg_count > 2) ||
+        (args->arg_type[0] != INT_RESULT) ||
+        ((arg_count == 2) && (args->arg_type[1] != INT_RESULT)))
+    {
+        strncpy(msg, "bad args, use capstomp_deadline(CONNECTION_ID()[, ms])",
+            MYSQL_ERRMSG_SIZE);
+        return 1;
+    }
+
+    initid->maybe_null = 0;
+    initid->const_item = 0;
+
+    return my_bool();
+}
+
+extern "C" long long capstomp_deadline(UDF_INIT*,
+    UDF_ARGS* args, char* is_null, char* error)
+{
+    *is_null = 0;
+
+    if (!args->args[0])
+    {
+        *error = 1;
+        return 0;
+    }
+
+    auto id = static_cast<std::uint64_t>(
+        *reinterpret_cast<long long*>(args->args[0]));
+
+    try
+    {
+        if ((args->arg_count == 2) && args->args[1])
+        {
+            auto new_deadline = *reinterpret_cast<long long*>(args->args[1]);
+            capst::conf::set_session_deadline(id, (new_deadline > 0) ?
+                static_cast<std::size_t>(new_deadline) : std::size_t());
+        }
+
+        return static_cast<long long>(capst::conf::session_deadline(id));
+    }
+    catch (const std::exception& e)
+    {
+        capst_journal.cerr([&]{
+            return std::string(e.what());
+        });
+    }
+    catch (...)
+    {
+        capst_journal.cerr([&]{
+            return ":*(";
+        });
+    }
+
+    *error = 1;
+    return 0;
+}
+
+extern "C" void capstomp_deadline_deinit(UDF_INIT*)
+{   }
+
+extern "C" my_bool capstomp_replay_size_init(UDF_INIT* initid,
+    UDF_ARGS* args, char* msg)
+{
+    auto arg_count = args->arg_count;
+    if ((arg_count == 1) && (args->arg_type[0] == INT_RESULT) && args->args[0])
+    {
+        auto new_replay_size = *reinterpret_cast<long long*>(args->args[0]);
+        capst::conf::set_replay_size(static_cast<std::size_t>(new_replay_size));
+
+        initid->ptr =
+            reinterpret_cast<char*>(static_cast<std::intptr_t>(
+                capst::conf::replay_size()));
+
+        return my_bool();
+    }
+    else if (arg_count == 0)
+    {
+        initid->ptr =
+            reinterpret_cast<char*>(static_cast<std::intptr_t>(
+                capst::conf::replay_size()));
+
+        return my_bool();
+    }
+
+    initid->ptr = nullptr;
+
+    strncpy(msg, "bad args, use capstomp_replay_size([bytes])",
+        MYSQL_ERRMSG_SIZE);
+
+    return 1;
+}
+
+extern "C" long long capstomp_replay_size(UDF_INIT* initid,
+    UDF_ARGS*, char* is_null, char* error)
+{
+    auto ptr = initid->ptr;
+    if (ptr)
+    {
+        return static_cast<long long>(
+                reinterpret_cast<std::intptr_t>(ptr));
+    }
+
+    *error = 1;
+    *is_null = 1;
+    return 0;
+}
+
+extern "C" void capstomp_replay_size_deinit(UDF_INIT*)
+{   }
+
+extern "C" my_bool capstomp_affinity_lanes_init(UDF_INIT* initid,
+    UDF_ARGS* args, char* msg)
+{
+    auto arg_count = args->arg_count;
+    if ((arg_count == 1) && (args->arg_type[0] == INT_RESULT) && args->args[0])
+    {
+        auto new_affinity_lanes = *reinterpret_cast<long long*>(args->args[0]);
+        capst::conf::set_affinity_lanes(static_cast<std::size_t>(new_affinity_lanes));
+
+        initid->ptr =
+            reinterpret_cast<char*>(static_cast<std::intptr_t>(
+                capst::conf::affinity_lanes()));
+
+        return my_bool();
+    }
+    else if (arg_count == 0)
+    {
+        initid->ptr =
+            reinterpret_cast<char*>(static_cast<std::intptr_t>(
+                capst::conf::affinity_lanes()));
+
+        return my_bool();
+    }
+
+    initid->ptr = nullptr;
+
+    strncpy(msg, "bad args, use capstomp_affinity_lanes([count])",
+        MYSQL_ERRMSG_SIZE);
+
+    return 1;
+}
+
+extern "C" long long capstomp_affinity_lanes(UDF_INIT* initid,
+    UDF_ARGS*, char* is_null, char* error)
+{
+    auto ptr = initid->ptr;
+    if (ptr)
+    {
+        return static_cast<long long>(
+                reinterpret_cast<std::intptr_t>(ptr));
+    }
+
+    *error = 1;
+    *is_null = 1;
+    return 0;
+}
+
+extern "C" void capstomp_affinity_lanes_deinit(UDF_INIT*)
+{   }
+
+extern "C" my_bool capstomp_stuck_timeout_init(UDF_INIT* initid,
+    UDF_ARGS* args, char* msg)
+{
+    auto arg_count = args->arg_count;
+    if ((arg_count == 1) && (args->arg_type[0] == INT_RESULT) && args->args[0])
+    {
+        auto new_stuck_timeout = *reinterpret_cast<long long*>(args->args[0]);
+        capst::conf::set_stuck_timeout(static_cast<std::size_t>(new_stuck_timeout));
+
+        initid->ptr =
+            reinterpret_cast<char*>(static_cast<std::intptr_t>(
+                capst::conf::stuck_timeout()));
+
+        return my_bool();
+    }
+    else if (arg_count == 0)
+    {
+        initid->ptr =
+            reinterpret_cast<char*>(static_cast<std::intptr_t>(
+                capst::conf::stuck_timeout()));
+
+        return my_bool();
+    }
+
+    initid->ptr = nullptr;
+
+    strncpy(msg, "bad args, use capstomp_stuck_timeout([ms])",
+        MYSQL_ERRMSG_SIZE);
+
+    return 1;
+}
+
+extern "C" long long capstomp_stuck_timeout(UDF_INIT* initid,
+    UDF_ARGS*, char* is_null, char* error)
+{
+    auto ptr = initid->ptr;
+    if (ptr)
+    {
+        return static_cast<long long>(
+                reinterpret_cast<std::intptr_t>(ptr));
+    }
+
+    *error = 1;
+    *is_null = 1;
+    return 0;
+}
+
+extern "C" void capstomp_stuck_timeout_deinit(UDF_INIT*)
+{   }
+
+extern "C" my_bool capstomp_session_timeout_init(UDF_INIT* initid,
+    UDF_ARGS* args, char* msg)
+{
+    auto arg_count = args->arg_count;
+    if ((arg_count == 1) && (args->arg_type[0] == INT_RESULT) && args->args[0])
+    {
+        auto new_session_timeout = *reinterpret_cast<long long*>(args->args[0]);
+        capst::conf::set_session_timeout(static_cast<std::size_t>(new_session_timeout));
+
+        initid->ptr =
+            reinterpret_cast<char*>(static_cast<std::intptr_t>(
+                capst::conf::session_timeout()));
+
+        return my_bool();
+    }
+    else if (arg_count == 0)
+    {
+        initid->ptr =
+            reinterpret_cast<char*>(static_cast<std::intptr_t>(
+                capst::conf::session_timeout()));
+
+        return my_bool();
+    }
+
+    initid->ptr = nullptr;
+
+    strncpy(msg, "bad args, use capstomp_session_timeout([seconds])",
+        MYSQL_ERRMSG_SIZE);
+
+    return 1;
+}
+
+extern "C" long long capstomp_session_timeout(UDF_INIT* initid,
+    UDF_ARGS*, char* is_null, char* error)
+{
+    auto ptr = initid->ptr;
+    if (ptr)
+    {
+        return static_cast<long long>(
+                reinterpret_cast<std::intptr_t>(ptr));
+    }
+
+    *error = 1;
+    *is_null = 1;
+    return 0;
+}
+
+extern "C" void capstomp_session_timeout_deinit(UDF_INIT*)
+{   }
+
 extern "C" my_bool capstomp_verbose_init(UDF_INIT* initid,
     UDF_ARGS* args, char* msg)
 {
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
 
 namespace capst {
 
@@ -17,8 +18,11 @@ class conf
     volatile std::size_t max_pool_count_ = {max_pool_count_def};
 
     static constexpr auto max_pool_sockets_min = std::size_t{8u};
+    // по нему выбран размер кольца транзакций пула
+    static constexpr auto max_pool_sockets_max = std::size_t{1024u};
     static constexpr auto max_pool_sockets_def
         = std::size_t{CAPSTOMP_MAX_POOL_SOCKETS};
+    static_assert(max_pool_sockets_def <= max_pool_sockets_max);
     volatile std::size_t max_pool_sockets_ = {max_pool_sockets_def};
 
     static constexpr auto pool_sockets_min = std::size_t{4u};
@@ -31,6 +35,71 @@ class conf
     // request conunt, before we ask delivery confirm
     volatile std::size_t request_limit_ = {request_limit_def};
 
+    static constexpr auto async_queue_size_min = std::size_t{64u};
+    static constexpr auto async_queue_size_def
+        = std::size_t{CAPSTOMP_ASYNC_QUEUE_SIZE};
+    // capacity of the pool queue for async publish
+    volatile std::size_t async_queue_size_ = {async_queue_size_def};
+
+    static constexpr auto cork_size_min = std::size_t{1024u};
+    static constexpr auto cork_size_def = std::size_t{CAPSTOMP_CORK_SIZE};
+    // bytes buffered in cork mode before flush
+    volatile std::size_t cork_size_ = {cork_size_def};
+
+    static constexpr auto dns_ttl_min = std::size_t{1u};
+    static constexpr auto dns_ttl_def = std::size_t{CAPSTOMP_DNS_TTL};
+    // seconds a resolved broker address is cached
+    volatile std::size_t dns_ttl_ = {dns_ttl_def};
+
+    static constexpr auto recycle_time_min = std::size_t{1u};
+    static constexpr auto recycle_time_def = std::size_t{CAPSTOMP_RECYCLE_TIME};
+    // seconds before a cluster connection is reopened on another node
+    volatile std::size_t recycle_time_ = {recycle_time_def};
+
+    static constexpr auto receipt_window_min = std::size_t{1u};
+    static constexpr auto receipt_window_max = std::size_t{128u};
+    static constexpr auto receipt_window_def = std::size_t{CAPSTOMP_RECEIPT_WINDOW};
+    // receipts awaited at once per connection, 1 - stop and wait
+    volatile std::size_t receipt_window_ = {receipt_window_def};
+
+    static constexpr auto heartbeat_def = std::size_t{CAPSTOMP_HEARTBEAT};
+    // stomp heart-beat interval in ms, 0 - disabled
+    volatile std::size_t heartbeat_ = {heartbeat_def};
+
+    static constexpr auto idle_timeout_min = std::size_t{1u};
+    static constexpr auto idle_timeout_def = std::size_t{CAPSTOMP_IDLE_TIMEOUT};
+    // seconds an idle pooled connection is kept open
+    volatile std::size_t idle_timeout_ = {idle_timeout_def};
+
+    static constexpr auto breaker_failures_def = std::size_t{CAPSTOMP_BREAKER_FAILURES};
+    // ошибок подключения подряд до размыкания, 0 отключает
+    volatile std::size_t breaker_failures_ = {breaker_failures_def};
+
+    static constexpr auto breaker_cooldown_min = std::size_t{100u};
+    static constexpr auto breaker_cooldown_def = std::size_t{CAPSTOMP_BREAKER_COOLDOWN};
+    // пауза разомкнутого автомата перед пробным подключением, мс
+    volatile std::size_t breaker_cooldown_ = {breaker_cooldown_def};
+
+    static constexpr auto replay_size_min = std::size_t{4096u};
+    static constexpr auto replay_size_def = std::size_t{CAPSTOMP_REPLAY_SIZE};
+    // bytes of unconfirmed frames a connection keeps for replay
+    volatile std::size_t replay_size_ = {replay_size_def};
+
+    static constexpr auto affinity_lanes_min = std::size_t{1u};
+    static constexpr auto affinity_lanes_max = std::size_t{64u};
+    static constexpr auto affinity_lanes_def = std::size_t{CAPSTOMP_AFFINITY_LANES};
+    // connections per pool used by affinity mode
+    volatile std::size_t affinity_lanes_ = {affinity_lanes_def};
+
+    static constexpr auto stuck_timeout_def = std::size_t{CAPSTOMP_STUCK_TIMEOUT};
+    // age in ms of a blocking transaction before the monitor commits past it, 0 disables
+    volatile std::size_t stuck_timeout_ = {stuck_timeout_def};
+
+    static constexpr auto session_timeout_min = std::size_t{1u};
+    static constexpr auto session_timeout_def = std::size_t{CAPSTOMP_SESSION_TIMEOUT};
+    // seconds a capstomp_begin transaction may stay open before it is aborted
+    volatile std::size_t session_timeout_ = {session_timeout_def};
+
     static constexpr auto verbose_max = std::size_t{2u};
     volatile std::size_t verbose_ = std::size_t{1u};
 
@@ -55,6 +124,11 @@ public:
         return inst().max_pool_sockets_;
     }
 
+    static constexpr std::size_t max_pool_sockets_limit() noexcept
+    {
+        return max_pool_sockets_max;
+    }
+
     static inline auto pool_sockets() noexcept
     {
         return inst().pool_sockets_;
@@ -65,6 +139,71 @@ public:
         return inst().request_limit_;
     }
 
+    static inline auto async_queue_size() noexcept
+    {
+        return inst().async_queue_size_;
+    }
+
+    static inline auto cork_size() noexcept
+    {
+        return inst().cork_size_;
+    }
+
+    static inline auto dns_ttl() noexcept
+    {
+        return inst().dns_ttl_;
+    }
+
+    static inline auto recycle_time() noexcept
+    {
+        return inst().recycle_time_;
+    }
+
+    static inline auto receipt_window() noexcept
+    {
+        return inst().receipt_window_;
+    }
+
+    static inline auto heartbeat() noexcept
+    {
+        return inst().heartbeat_;
+    }
+
+    static inline auto idle_timeout() noexcept
+    {
+        return inst().idle_timeout_;
+    }
+
+    static inline auto breaker_failures() noexcept
+    {
+        return inst().breaker_failures_;
+    }
+
+    static inline auto breaker_cooldown() noexcept
+    {
+        return inst().breaker_cooldown_;
+    }
+
+    static inline auto replay_size() noexcept
+    {
+        return inst().replay_size_;
+    }
+
+    static inline auto affinity_lanes() noexcept
+    {
+        return inst().affinity_lanes_;
+    }
+
+    static inline auto stuck_timeout() noexcept
+    {
+        return inst().stuck_timeout_;
+    }
+
+    static inline auto session_timeout() noexcept
+    {
+        return inst().session_timeout_;
+    }
+
     static inline std::size_t verbose() noexcept
     {
         return inst().verbose_;
@@ -80,7 +219,39 @@ public:
 
     static void set_request_limit(std::size_t value) noexcept;
 
+    static void set_async_queue_size(std::size_t value) noexcept;
+
+    static void set_cork_size(std::size_t value) noexcept;
+
+    static void set_dns_ttl(std::size_t value) noexcept;
+
+    static void set_recycle_time(std::size_t value) noexcept;
+
+    static void set_receipt_window(std::size_t value) noexcept;
+
+    static void set_heartbeat(std::size_t value) noexcept;
+
+    static void set_idle_timeout(std::size_t value) noexcept;
+
+    static void set_breaker_failures(std::size_t value) noexcept;
+
+    static void set_breaker_cooldown(std::size_t value) noexcept;
+
+    static void set_replay_size(std::size_t value) noexcept;
+
+    static void set_affinity_lanes(std::size_t value) noexcept;
+
+    static void set_stuck_timeout(std::size_t value) noexcept;
+
+    static void set_session_timeout(std::size_t value) noexcept;
+
     static void set_verbose(std::size_t value) noexcept;
+
+    // budget of one udf call in ms for a CONNECTION_ID(), 0 - none
+    static std::size_t session_deadline(std::uint64_t id) noexcept;
+
+    // 0 removes the value of the connection
+    static void set_session_deadline(std::uint64_t id, std::size_t value);
 };
 
 } // namespace capst
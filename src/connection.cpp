@@ -1,11 +1,21 @@
 #include "connection.hpp"
 #include "journal.hpp"
+#include "sender.hpp"
 #include "pool.hpp"
 #include "conf.hpp"
-
-#include "btpro/sock_addr.hpp"
+#include "resolver.hpp"
+#include "monitor.hpp"
+#include "connector.hpp"
 
 #include <poll.h>
+#include <sys/uio.h>
+#include <climits>
+#include <chrono>
+#include <charconv>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cerrno>
 #include <event2/keyvalq_struct.h>
 
 using namespace std::literals;
@@ -20,11 +30,66 @@ constexpr auto stomp_def = 61613;
 #define CAPSTOMP_STATE(x) {}
 #endif // CAPSTOMP_STATE_DEBUG
 
-connection::connection(pool& pool)
+// heart-beat:sx,sy из CONNECTED
+// брокер шлет нам не чаще max(sx, cy), 0 - не шлет
+std::size_t negotiate_heartbeat(std::string_view frame, std::size_t cy) noexcept
+{
+    constexpr auto key = "\nheart-beat:"sv;
+    auto pos = frame.find(key);
+    if (pos == std::string_view::npos)
+        return 0;
+
+    auto value = frame.substr(pos + key.size());
+    value = value.substr(0, value.find('\n'));
+
+    std::size_t sx = 0;
+    auto comma = value.find(',');
+    if (comma == std::string_view::npos)
+        return 0;
+
+    auto [ptr, ec] = std::from_chars(value.data(), value.data() + comma, sx);
+    if ((ec != std::errc()) || !sx)
+        return 0;
+
+    return std::max(sx, cy);
+}
+
+// message-id уникален между перезапусками сервера
+static const std::string& process_tag()
+{
+    static const std::string tag = []{
+        std::random_device rd;
+        std::uint64_t value = (static_cast<std::uint64_t>(rd()) << 32) | rd();
+        char buf[24];
+        auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), value, 16);
+        return std::string(buf, end);
+    }();
+    return tag;
+}
+
+static std::atomic<std::uint64_t> connection_uid{};
+
+// номера транзакций сессий, вне кольца пулов
+static std::atomic<std::uint64_t> session_seq{};
+
+connection::connection(pool& pool, std::size_t index)
     : pool_(pool)
+    , index_(index)
 {
+    replay_tag_ = process_tag();
+    replay_tag_ += '-';
+    replay_tag_ += std::to_string(++connection_uid);
+    replay_tag_ += '-';
+
     stomplay_.on_logon([&](stompconn::packet logon){
-        receipt_received_ = true;
+        // при конвейерном входе ожидание квитанции принадлежит фрейму
+        if (handshake_)
+            logon_received_ = true;
+        else
+            receipt_received_ = true;
+        heartbeat_in_ = std::size_t();
+        if (logon && heartbeat_ask_)
+            heartbeat_in_ = negotiate_heartbeat(logon.dump(), heartbeat_ask_);
         if (!logon)
         {
             auto error = logon.payload().str();
@@ -44,6 +109,7 @@ connection::connection(pool& pool)
 
     stomplay_.on_error([&](stompconn::packet packet){
         receipt_received_ = true;
+        logon_received_ = true;
         auto error = packet.dump();
         std::replace(error.begin(), error.end(), '\n', ' ');
         error_ = error;
@@ -82,6 +148,19 @@ void connection::close() noexcept
     }
 
     socket_.close();
+    fd_.store(-1, std::memory_order_relaxed);
+
+    // ответы на старом сокете уже не придут
+    receipt_head_ = receipt_next_;
+
+    if (node_ != cluster::npos)
+    {
+        pool_.nodes().closed(node_);
+        node_ = cluster::npos;
+    }
+
+    output_.clear();
+    handshake_ = false;
     destination_.clear();
     passhash_ = std::size_t();
     request_count_ = std::size_t();
@@ -92,7 +171,41 @@ void connection::init(const settings& conf) noexcept
 {
     transaction_id_.clear();
     error_.clear();
+    uri_.clear();
+    sender_ = nullptr;
+    pipeline_ = false;
+    thread_ = std::this_thread::get_id();
     conf_ = conf;
+    start_deadline();
+}
+
+void connection::start_deadline() noexcept
+{
+    // действует меньший из заданных сроков
+    auto ms = conf_.deadline_ms();
+    auto session = conf::session_deadline(conf_.session());
+    if (session && (!ms || (session < ms)))
+        ms = session;
+
+    deadline_ = ms ? cluster::clock::now() + std::chrono::milliseconds(ms) :
+        cluster::clock::time_point::max();
+}
+
+int connection::poll_timeout(std::string_view what) const
+{
+    using std::chrono::duration_cast;
+    using std::chrono::milliseconds;
+
+    auto timeout = static_cast<std::int64_t>(conf::timeout());
+    if (deadline_ == cluster::clock::time_point::max())
+        return static_cast<int>(timeout);
+
+    auto left = duration_cast<milliseconds>(
+        deadline_ - cluster::clock::now()).count();
+    if (left <= 0)
+        throw deadline_error(std::string("deadline: ") + std::string(what));
+
+    return static_cast<int>(std::min(timeout, static_cast<std::int64_t>(left)));
 }
 
 int socket_poll(btpro::socket socket, short int events, int timeout)
@@ -128,144 +241,430 @@ int socket_poll(btpro::socket socket, short int events, int timeout)
     return ev.revents;
 }
 
-bool socket_ready_write(btpro::socket socket, int timeout)
-{
-    return (POLLOUT & socket_poll(socket, POLLOUT, timeout)) > 0;
-}
+// задержка запуска следующего адреса, rfc 8305
+constexpr auto attempt_delay = 250;
 
-void connect_sync(btpro::socket socket, btpro::ip::addr addr, int timeout)
+// подключение сразу к нескольким адресам
+// следующий адрес стартует по таймеру или после отказа предыдущего
+// побеждает первый подключившийся сокет
+btpro::socket connect_any(const resolver::list_type& list, int timeout)
 {
-    auto rc = ::connect(socket.fd(), addr.sa(), addr.size());
-    if (btpro::code::fail == rc)
+    using clock = std::chrono::steady_clock;
+    using std::chrono::milliseconds;
+    using std::chrono::duration_cast;
+
+    auto deadline = clock::now() + milliseconds(timeout);
+
+    std::vector<pollfd> wait;
+    std::vector<btpro::socket> sock;
+    wait.reserve(list.size());
+    sock.reserve(list.size());
+
+    auto close_all = [&]{
+        for (auto& s : sock)
+            s.close();
+    };
+
+    std::string error;
+    std::size_t next = 0;
+    auto start = true;
+
+    try
     {
-        if (!btpro::socket::inprogress())
-            throw std::system_error(btpro::net::error_code(), "::connect");
+        while (true)
+        {
+            for (; start && (next < list.size()); ++next)
+            {
+                auto& a = list[next];
 
-        if (!socket_ready_write(socket, timeout))
-            throw std::runtime_error("connect timeout");
-    }
-}
+                btpro::socket s;
+                // сокет создается неблокируемым
+                s.create(a.family(), btpro::sock_stream);
+                auto rc = ::connect(s.fd(), a.sa(), a.size);
+                if (rc == 0)
+                {
+                    close_all();
+                    return s;
+                }
 
-btpro::socket try_connect(btpro::ip::addr addr, int timeout)
-{
-    btpro::socket sock;
-    // сокет создается неблокируемым
-    sock.create(addr.family(), btpro::sock_stream);
-    connect_sync(sock, addr, timeout);
-    return sock;
-}
+                if (!btpro::socket::inprogress())
+                {
+                    error = std::system_error(btpro::net::error_code(),
+                        "::connect").what();
+                    s.close();
+                    continue;
+                }
 
-btpro::socket try_gethostname_connect(const std::string& host, 
-    const std::string& port, int timeout)
-{
-    capst_journal.trace([&]{
-        std::string text;
-        text.reserve(64);
-        text += "connection: resolve connect to "sv;
-        text += host, text += ':', text += port;
-        return text;
-    });
+                capst_journal.trace([&]{
+                    std::string text;
+                    text.reserve(64);
+                    text += "connection: connect attempt "sv;
+                    text += std::to_string(next + 1);
+                    text += " of "sv;
+                    text += std::to_string(list.size());
+                    text += " socket="sv;
+                    text += std::to_string(s.fd());
+                    return text;
+                });
 
-    addrinfo *result = nullptr;
-    addrinfo hints{0, AF_UNSPEC, SOCK_STREAM, 0, 0, nullptr, nullptr, nullptr};
-    auto rc = getaddrinfo(host.c_str(), port.c_str(), &hints, &result);
-    if (0 != rc) 
-    {
-        std::string msg{"getaddrinfo: "sv};
-        msg += std::to_string(rc);
-        msg += ' ';
-        msg += host;
-
-        if (rc == EAI_SYSTEM)
-            throw std::system_error(btpro::net::error_code(), msg);
-            
-        std::string text(gai_strerror(rc));
-        text += ' '; text += msg;
-        throw std::runtime_error(text);
-    }
-    
-    using holder_type = std::unique_ptr<addrinfo, void(*)(addrinfo*)>;
-    holder_type a(result, [](addrinfo* ptr){
-        freeaddrinfo(ptr);
-    });
+                wait.push_back(pollfd{s.fd(), POLLOUT, 0});
+                sock.push_back(s);
+                start = false;
+            }
+
+            if (wait.empty())
+                break;
+
+            auto now = clock::now();
+            if (now >= deadline)
+            {
+                error = "connect timeout";
+                break;
+            }
+
+            auto delay = duration_cast<milliseconds>(deadline - now).count();
+            if (next < list.size())
+                delay = std::min<decltype(delay)>(delay, attempt_delay);
+
+            auto rc = ::poll(wait.data(), wait.size(), static_cast<int>(delay));
+            if (btpro::code::fail == rc)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                throw std::system_error(btpro::net::error_code(), "poll");
+            }
+
+            // таймер попытки, запускаем следующий адрес
+            start = (rc == 0);
+
+            for (std::size_t i = 0; i < wait.size(); )
+            {
+                if (!wait[i].revents)
+                {
+                    ++i;
+                    continue;
+                }
+
+                int err = 0;
+                socklen_t len = sizeof(err);
+                if (::getsockopt(wait[i].fd, SOL_SOCKET, SO_ERROR, &err, &len))
+                    err = errno;
+
+                if (!err)
+                {
+                    auto s = sock[i];
+                    sock.erase(sock.begin() + static_cast<std::ptrdiff_t>(i));
+                    close_all();
+                    return s;
+                }
+
+                error = std::system_error(err,
+                    std::system_category(), "::connect").what();
 
-    if (nullptr == result)
+                sock[i].close();
+                sock.erase(sock.begin() + static_cast<std::ptrdiff_t>(i));
+                wait.erase(wait.begin() + static_cast<std::ptrdiff_t>(i));
+
+                // отказ, следующий адрес без задержки
+                start = true;
+            }
+        }
+    }
+    catch (...)
     {
-        std::string text{"unable to connect getaddrinfo: "sv};
-        text += host;
-        throw std::runtime_error(text);
+        close_all();
+        throw;
     }
 
-    auto addr = btpro::ip::addr::create(result->ai_addr, result->ai_addrlen);
-    return try_connect(std::move(addr), timeout);
+    close_all();
+
+    throw std::runtime_error(error);
 }
 
-btpro::socket connection::create_connection(const btpro::uri& u, int timeout)
+btpro::socket connection::create_connection(const std::string& host,
+    int port, int timeout)
 {
     capst_journal.trace([&]{
         std::string text;
         text.reserve(64);
         text += "connection: connect to "sv;
-        text += u.addr_port(stomp_def);
+        text += host;
+        text += ':';
+        text += std::to_string(port);
         return text;
     });
 
-    try
-    {
-        return try_connect(btpro::sock_addr{u.addr_port(stomp_def)}, timeout);
-    }
-    catch (const std::exception& e)
+    // числовые адреса тоже проходят через кеш
+    // getaddrinfo разбирает их без обращения к dns
+    auto list = resolver::inst().resolve(host, std::to_string(port), timeout);
+
+    return connect_any(*list, timeout);
+}
+
+void connection::connect_node(const btpro::uri& u, cluster& nodes)
+{
+    std::string error;
+
+    // каждый отказавший узел исключается, следующий выбор его пропустит
+    for (std::size_t n = 0; n < nodes.size(); ++n)
     {
-        capst_journal.trace([&]{
-            std::string text;
-            text.reserve(64);
-            text += "connection: "sv;
-            text += e.what();
-            return text;
-        });
+        auto i = nodes.select();
+        auto& node = nodes.at(i);
+        try
+        {
+            auto start = cluster::clock::now();
+
+            // узлы перебираются в пределах одного срока
+            socket_ = create_connection(node.host, node.port,
+                poll_timeout("connect"sv));
+            fd_.store(socket_.fd(), std::memory_order_relaxed);
+
+            destination_ = u.fragment();
+
+            // вход узла кластера проверяется сразу,
+            // отказ учитывается в выборе и переводит на следующий узел
+            logon(u, false);
+
+            connect_time_ = cluster::clock::now();
+            nodes.connected(i, connect_time_ - start);
+            node_ = i;
+
+            return;
+        }
+        catch (const deadline_error&)
+        {
+            // срок вызова исчерпан, узел не виноват
+            close();
+            throw;
+        }
+        catch (const std::exception& e)
+        {
+            error = e.what();
+
+            capst_journal.cerr([&]{
+                std::string text;
+                text.reserve(64);
+                text += "connection: broker "sv;
+                text += node.host;
+                text += ':';
+                text += std::to_string(node.port);
+                text += " - "sv;
+                text += error;
+                return text;
+            });
+        }
+
+        nodes.failed(i);
+        close();
     }
 
-    return try_gethostname_connect(std::string{u.host()}, 
-        std::to_string(u.port(stomp_def)), timeout);
+    throw std::runtime_error(error);
+}
+
+bool connection::reusable(const btpro::uri& u)
+{
+    std::hash<std::string_view> hf;
+    auto [login, passcode] = u.auth();
+
+    // соединения с кластером периодически пересоздаются,
+    // чтобы нагрузка выровнялась после возврата узла
+    auto recycle = (node_ != cluster::npos) &&
+        (cluster::clock::now() - connect_time_ >
+            std::chrono::seconds(conf::recycle_time()));
+
+    // проверяем было ли откличючение и совпадает ли пароль
+    return !recycle && connected() && (hf(passcode) == passhash_);
 }
 
-// подключаемся только на локалхост
 void connection::connect(const btpro::uri& u)
+{
+    open(u);
+
+    // начинаем транзакцию
+    begin();
+}
+
+void connection::open(const btpro::uri& u)
 {
     CAPSTOMP_STATE(2);
 
     std::hash<std::string_view> hf;
     auto [login, passcode] = u.auth();
     auto passhash = hf(passcode);
-    // проверяем было ли откличючение и совпадает ли пароль
-    if (!(connected() && (passhash == passhash_)))
+
+    auto& nodes = pool_.nodes();
+    if (!reusable(u))
     {
         // закроем сокет
         close();
 
-        // резолвим адрес если нужно
-        socket_ = create_connection(u, static_cast<int>(conf::timeout()));
+        // брокер недоступен, не ждем таймаута
+        auto& circuit = pool_.circuit();
+        if (!circuit.allow())
+        {
+            throw std::runtime_error("circuit breaker open: " +
+                u.addr_port(stomp_def));
+        }
+
+        try
+        {
+            if (nodes.size())
+                connect_node(u, nodes);
+            else
+            {
+                // резолвим адрес если нужно
+                socket_ = create_connection(std::string{u.host()},
+                    u.port(stomp_def), poll_timeout("connect"sv));
+                fd_.store(socket_.fd(), std::memory_order_relaxed);
+
+                destination_ = u.fragment();
 
-        destination_ = u.fragment();
+                logon(u, pipeline_ && conf_.pipeline());
+            }
+        }
+        catch (const deadline_error&)
+        {
+            circuit.cancel();
+            throw;
+        }
+        catch (...)
+        {
+            circuit.failure();
+            throw;
+        }
 
-        logon(u);
+        // при конвейерном входе исход известен после ответа
+        if (!handshake_)
+            circuit.success();
 
         // сохраняем пароль
         passhash_ = passhash;
+
+        // фреймы без квитанции с прошлого сокета
+        replay();
     }
 
     capst_journal.trace([&]{
         std::string text;
         text.reserve(64);
         text += "connection: is connnected to "sv;
-        text += u.addr_port(stomp_def);
+        if (node_ != cluster::npos)
+        {
+            auto& node = nodes.at(node_);
+            text += node.host;
+            text += ':';
+            text += std::to_string(node.port);
+        }
+        else
+            text += u.addr_port(stomp_def);
         text += " socket="sv;
         text += std::to_string(socket_.fd());
         return text;
     });
+}
 
-    // начинаем транзакцию
-    begin();
+void connection::prepare(const btpro::uri& u, const std::string& uri)
+{
+    CAPSTOMP_STATE(2);
+
+    // заготовка фрейма строится до подключения
+    destination_ = u.fragment();
+    uri_ = uri;
+    pending_ = true;
+    // BEGIN уйдет с первым фреймом, CONNECT без ожидания только по pipeline=1
+    pipeline_ = true;
+
+    // новое подключение устанавливается в фоне, пока запрос идет к первой строке
+    // живой сокет дождется первого фрейма
+    // транзакцию создает establish в потоке вызова
+    if (!reusable(u))
+    {
+        establish_ = connector::inst().post([this]{
+            btpro::uri u(uri_);
+            open(u);
+        });
+    }
+}
+
+void connection::establish()
+{
+    if (!pending_)
+        return;
+
+    pending_ = false;
+
+    if (establish_.valid())
+    {
+        // фоновое подключение использовало срок init
+        establish_.get();
+
+        begin();
+    }
+    else
+    {
+        start_deadline();
+
+        btpro::uri u(uri_);
+        connect(u);
+    }
+}
+
+void connection::abandon() noexcept
+{
+    if (!pending_)
+        return;
+
+    pending_ = false;
+
+    // строк не было, но начатое подключение надо дождаться
+    // удачное останется в пуле для следующих запросов
+    if (establish_.valid())
+    {
+        try
+        {
+            establish_.get();
+        }
+        catch (const std::exception& e)
+        {
+            capst_journal.cerr([&]{
+                std::string text;
+                text.reserve(64);
+                text += "connection: "sv;
+                text += e.what();
+                return text;
+            });
+
+            close();
+        }
+        catch (...)
+        {
+            close();
+        }
+    }
+}
+
+void connection::connect_async(const btpro::uri& u, const std::string& uri)
+{
+    CAPSTOMP_STATE(2);
+
+    destination_ = u.fragment();
+
+    sender_ = &pool_.async(uri);
+}
+
+void connection::connect_affinity(const btpro::uri& u, const std::string& uri)
+{
+    CAPSTOMP_STATE(2);
+
+    destination_ = u.fragment();
+    uri_ = uri;
+    lane_ = std::size_t();
+}
+
+void connection::route(std::string_view key) noexcept
+{
+    lane_ = pool_.lane_index(key);
 }
 
 bool connection::connected()
@@ -274,6 +673,10 @@ bool connection::connected()
     if (!socket_.good())
         return false;
 
+    // входящие простаивающих соединений разбирает монитор
+    if (monitor::active())
+        return true;
+
     while (ready_read(0))
     {
         if (!read_stomp("connected"sv))
@@ -286,28 +689,30 @@ bool connection::connected()
     return true;
 }
 
-void connection::set(connection_id_type self) noexcept
-{
-    self_ = self;
-}
-
 void connection::set(transaction_id_type id) noexcept
 {
-    capst_journal.trace([&, id]{
+    // заголовок seq@name пишется в буфер соединения
+    // его память переиспользуется между транзакциями
+    char buf[24];
+    auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), id);
+    transaction_id_.assign(buf, end);
+    transaction_id_ += '@';
+    transaction_id_ += pool_.name();
+
+    transaction_ = id;
+
+    capst_journal.trace([&]{
         std::string text;
         text.reserve(64);
         text += "connection: socket="sv;
         text += std::to_string(socket_.fd());
         text += " set deferred transaction:"sv;
-        text += id->id();
+        text += transaction_id_;
         return text;
     });
-
-    transaction_ = id;
-    transaction_id_ = id->id();
 }
 
-void connection::logon(const btpro::uri& u)
+void connection::logon(const btpro::uri& u, bool pipeline)
 {
     CAPSTOMP_STATE(3);
 
@@ -337,7 +742,29 @@ void connection::logon(const btpro::uri& u)
     });
 
     auto [login, passcode] = u.auth();
-    send(stompconn::logon(path, login, passcode));
+    stompconn::logon frame(path, login, passcode);
+
+    // сами heart-beat не обещаем, их шлет монитор только в простое
+    // от брокера просим, чтобы заметить обрыв
+    heartbeat_ask_ = conf::heartbeat();
+    std::string heartbeat;
+    if (heartbeat_ask_)
+    {
+        heartbeat = "0,"sv;
+        heartbeat += std::to_string(heartbeat_ask_);
+        frame.push(stompconn::header::make("heart-beat"sv, heartbeat));
+    }
+
+    // CONNECT уходит сразу, ответ проверит первая отправка фрейма
+    if (pipeline)
+    {
+        send(frame.data());
+        handshake_ = true;
+        logon_received_ = false;
+        return;
+    }
+
+    send(std::move(frame));
     read("logon"sv);
 
     // должна быть получена сессия
@@ -345,34 +772,162 @@ void connection::logon(const btpro::uri& u)
         throw std::runtime_error("stomplay: no session");
 }
 
-void connection::begin()
+void connection::confirm_logon()
 {
-    CAPSTOMP_STATE(4);
-
-    ++request_count_;
-
-    // если транзакций нет - выходим
-    if (!conf_.transaction())
+    if (!handshake_)
         return;
 
-    // создаем транзакцию
-    set(pool_.create_transaction(self_));
-
-    // начинаем транзакцию
-    send(stompconn::begin(transaction_id_), is_receipt());
-    read("begin"sv);
-}
-
-void connection::commit_transaction(transaction_type& transaction, bool receipt)
-{
-    auto transaction_id = transaction.id();
-    auto connection_id = transaction.connection();
-
-    try
+    auto& circuit = pool_.circuit();
+    while (!logon_received_)
     {
-#ifdef CAPSTOMP_STATE_DEBUG
-        connection_id->set_state(9);
+        int timeout = 0;
+        try
+        {
+            timeout = poll_timeout("logon"sv);
+        }
+        catch (const deadline_error&)
+        {
+            close();
+            circuit.cancel();
+            throw;
+        }
+
+        if (ready_read(timeout))
+        {
+            if (!read_stomp("logon"sv))
+            {
+                close();
+                circuit.failure();
+                throw std::runtime_error("disconnect: logon");
+            }
+        }
+        else
+        {
+            close();
+            circuit.failure();
+            throw std::runtime_error("timeout: logon");
+        }
+    }
+
+    handshake_ = false;
+
+    // брокер отклонил вход, BEGIN и фреймы после него отброшены
+    if (!error_.empty() || stomplay_.session().empty())
+    {
+        auto error = error_.empty() ?
+            std::string("stomplay: no session") : error_;
+        close();
+        circuit.failure();
+        throw std::runtime_error(error);
+    }
+
+    circuit.success();
+}
+
+void connection::begin()
+{
+    CAPSTOMP_STATE(4);
+
+    ++request_count_;
+
+    // если транзакций нет - выходим
+    if (!conf_.transaction())
+        return;
+
+    // создаем транзакцию
+    set(pool_.create_transaction(this, !conf_.order_by().empty()));
+
+    // BEGIN уйдет одной записью с первым фреймом
+    if (pipeline_)
+    {
+        stompconn::begin frame(transaction_id_);
+        if (capst_journal.allow_trace())
+            trace_frame(frame.str());
+        output_ += frame.str();
+        return;
+    }
+
+    // начинаем транзакцию
+    send(stompconn::begin(transaction_id_), is_receipt());
+    read("begin"sv);
+}
+
+void connection::order(std::string_view key) noexcept
+{
+    if (transaction_)
+        pool_.order_transaction(transaction_, key);
+}
+
+void connection::begin_session(const btpro::uri& u)
+{
+    connect(u);
+
+    // транзакция сессии не входит в очередь коммитов пула
+    char buf[24];
+    auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), ++session_seq);
+    transaction_id_.assign("s"sv);
+    transaction_id_.append(buf, end);
+    transaction_id_ += '@';
+    transaction_id_ += pool_.name();
+
+    capst_journal.trace([&]{
+        std::string text;
+        text.reserve(64);
+        text += "connection: socket="sv;
+        text += std::to_string(socket_.fd());
+        text += " begin session transaction:"sv;
+        text += transaction_id_;
+        return text;
+    });
+
+    send(stompconn::begin(transaction_id_), true);
+    read("begin_session"sv);
+}
+
+void connection::end_session(bool commit)
+{
+    start_deadline();
+
+    try
+    {
+        // накопленные фреймы уходят до COMMIT
+        flush_output();
+
+        if (!good())
+        {
+            throw std::runtime_error("session transaction lost: " +
+                transaction_id_);
+        }
+
+        if (commit)
+            send(stompconn::commit(transaction_id_), true);
+        else
+            send(stompconn::abort(transaction_id_), true);
+
+        read("end_session"sv);
+    }
+    catch (...)
+    {
+        close();
+        // возможно это уничтожит этот объект
+        release();
+        throw;
+    }
+
+    release();
+}
+
+void connection::commit_transaction(connection_id_type connection_id, bool receipt)
+{
+    auto transaction_id = connection_id->transaction_id();
+
+    try
+    {
+#ifdef CAPSTOMP_STATE_DEBUG
+        connection_id->set_state(9);
 #endif
+        // цепочка транзакций коммитится в сроке вызывающего
+        connection_id->deadline_ = deadline_;
         if (receipt)
         {
             connection_id->send(stompconn::commit(transaction_id), receipt);
@@ -423,7 +978,7 @@ void connection::commit_transaction(transaction_type& transaction, bool receipt)
         });
     }
 
-    if (connection_id != self_)
+    if (connection_id != this)
     {
         capst_journal.cout([&]{
             std::string text;
@@ -438,11 +993,11 @@ void connection::commit_transaction(transaction_type& transaction, bool receipt)
     }
 }
 
-std::size_t connection::commit(transaction_store_type transaction_store)
+std::size_t connection::commit(transaction_range range)
 {
     CAPSTOMP_STATE(8);
 
-    auto rc = transaction_store.size();
+    auto rc = range.size();
 
     if (rc > 1)
     {
@@ -461,14 +1016,158 @@ std::size_t connection::commit(transaction_store_type transaction_store)
 
     // если транзакция одна то используем флаг подтверждений из конфига
     // если несколько то подтверждаем все
-    bool receipt = (rc == 1) ? is_receipt() : true;
-
-    for (auto& transaction : transaction_store)
-        commit_transaction(transaction, receipt);
+    if ((rc == 1) && (range.ids.front() == transaction_))
+        commit_transaction(this, is_receipt());
+    else
+        commit_group(range);
 
     return rc;
 }
 
+void connection::commit_group(transaction_range range)
+{
+    using std::chrono::duration_cast;
+    using std::chrono::milliseconds;
+
+    // транзакции выполненные вне очереди и чужие пропускаем
+    std::vector<connection*> group;
+    group.reserve(range.size());
+    for (auto i : range.ids)
+    {
+        auto connection_id = pool_.transaction_connection(range, i);
+        if (connection_id)
+            group.push_back(connection_id);
+    }
+
+    // сначала все COMMIT, каждый на своем сокете
+    std::vector<connection*> wait;
+    wait.reserve(group.size());
+    for (auto connection_id : group)
+    {
+#ifdef CAPSTOMP_STATE_DEBUG
+        connection_id->set_state(9);
+#endif
+        try
+        {
+            // цепочка транзакций коммитится в сроке вызывающего
+            connection_id->deadline_ = deadline_;
+            connection_id->send(
+                stompconn::commit(connection_id->transaction_id()), true);
+            wait.push_back(connection_id);
+        }
+        catch (const std::exception& e)
+        {
+            // close очищает ошибку
+            connection_id->close();
+            connection_id->error_ = e.what();
+        }
+        catch (...)
+        {
+            connection_id->close();
+            connection_id->error_ = "send"sv;
+        }
+    }
+
+    // квитанции приходят параллельно, цепочка стоит около одного rtt
+    std::string error{"timeout: commit_transaction"};
+    try
+    {
+        auto end = cluster::clock::now() +
+            milliseconds(poll_timeout("commit_transaction"sv));
+
+        std::vector<pollfd> fds;
+        fds.reserve(wait.size());
+        while (!wait.empty())
+        {
+            auto left = duration_cast<milliseconds>(
+                end - cluster::clock::now()).count();
+            if (left <= 0)
+                break;
+
+            fds.clear();
+            for (auto c : wait)
+                fds.push_back({ c->socket_.fd(), POLLIN, 0 });
+
+            auto rc = ::poll(fds.data(), fds.size(), static_cast<int>(left));
+            if (btpro::code::fail == rc)
+            {
+                if (errno == EINTR)
+                    continue;
+                throw std::system_error(btpro::net::error_code(), "poll");
+            }
+
+            for (std::size_t i = 0; i < fds.size(); ++i)
+            {
+                if (!fds[i].revents)
+                    continue;
+
+                auto c = wait[i];
+                try
+                {
+                    if (!c->read_stomp("commit_transaction"sv))
+                    {
+                        c->close();
+                        c->error_ = "disconnect: commit_transaction"sv;
+                        c->receipt_received_ = true;
+                    }
+                }
+                catch (const std::exception& e)
+                {
+                    c->close();
+                    c->error_ = e.what();
+                    c->receipt_received_ = true;
+                }
+            }
+
+            wait.erase(std::remove_if(wait.begin(), wait.end(),
+                [](connection* c) {
+                    return c->receipt_received_;
+                }), wait.end());
+        }
+    }
+    catch (const std::exception& e)
+    {
+        error = e.what();
+    }
+
+    // состояние сокетов без квитанции неизвестно
+    for (auto c : wait)
+    {
+        c->close();
+        c->error_ = error;
+    }
+
+    for (auto connection_id : group)
+    {
+        if (!connection_id->error_.empty())
+        {
+            capst_journal.cerr([&]{
+                std::string text;
+                text.reserve(64);
+                text += "error commit: "sv;
+                text += connection_id->transaction_id();
+                text += " - "sv;
+                text += connection_id->error_;
+                return text;
+            });
+        }
+
+        if (connection_id != this)
+        {
+            capst_journal.cout([&]{
+                std::string text;
+                text.reserve(64);
+                text += "connection: transaction:"sv;
+                text += connection_id->transaction_id();
+                text += " release deffered"sv;
+                return text;
+            });
+
+            pool_.release(connection_id);
+        }
+    }
+}
+
 bool connection::ready_read(int timeout)
 {
     return (POLLIN & ready(POLLIN, timeout)) > 0;
@@ -484,8 +1183,8 @@ void connection::read(std::string_view marker)
     while (!receipt_received_)
     {
         // ждем события чтения
-        // таймаут на разовое чтение
-        if (ready_read(static_cast<int>(conf::timeout())))
+        // таймаут на разовое чтение, но не дольше срока вызова
+        if (ready_read(poll_timeout(marker)))
         {
             if (!read_stomp(marker))
             {
@@ -534,6 +1233,32 @@ bool connection::read_stomp(std::string_view marker)
 
 void connection::commit()
 {
+    // отложенное подключение так и не понадобилось
+    abandon();
+
+    // накопленное должно уйти до коммита
+    flush_output();
+
+    // вход без фреймов проверяется здесь
+    // при отказе сокет закрыт, коммит его пропустит
+    try
+    {
+        confirm_logon();
+    }
+    catch (const std::exception& e)
+    {
+        capst_journal.cerr([&]{
+            std::string text;
+            text.reserve(64);
+            text += "connection: logon - "sv;
+            text += e.what();
+            return text;
+        });
+    }
+
+    // и все квитанции окна должны прийти
+    drain_receipts();
+
     // если была транзакиця
     // пытаемся ее закомитить
     if (with_transaction())
@@ -577,7 +1302,7 @@ void connection::force_commit()
         return text;
     });
 
-    commit_transaction(*transaction_, true);
+    commit_transaction(this, true);
 }
 
 void connection::release()
@@ -606,16 +1331,86 @@ void connection::release()
 
     // возможно это уничтожит этот объект
     // дальше им пользоваться уже нельзя
-    pool_.release(self_);
+    pool_.release(this);
 }
 
 bool connection::is_receipt() noexcept
 {
     auto receipt = conf_.receipt();
+
+    // окно повтора подтверждается квитанцией до переполнения
+    if (!receipt && conf_.replay() &&
+        (replay_bytes_ >= conf::replay_size() / 2))
+    {
+        return true;
+    }
+
     return (!receipt) ?
         request_count_ >= conf::request_limit() : receipt;
 }
 
+bool connection::heartbeat(cluster::clock::time_point now) noexcept
+{
+    // асинхронные соединения хранятся без сокета
+    if (!socket_.good())
+        return true;
+
+    try
+    {
+        char input[2048];
+        while (true)
+        {
+            auto rc = ::recv(socket_.fd(), input, sizeof(input), MSG_DONTWAIT);
+            if (rc > 0)
+            {
+                auto size = static_cast<std::size_t>(rc);
+                if (size != stomplay_.parse(input, size))
+                    return false;
+
+                read_time_ = now;
+                continue;
+            }
+
+            // дисконнект или ошибка
+            if (!rc || !btpro::socket::wouldblock())
+                return false;
+
+            break;
+        }
+
+        // брокер прислал ERROR
+        if (!error_.empty())
+            return false;
+
+        // брокер молчит дольше двух интервалов
+        using std::chrono::milliseconds;
+        if (heartbeat_in_ && (now - read_time_ > milliseconds(2 * heartbeat_in_)))
+            return false;
+
+        // держим NAT и балансировщики, шлем только перевод строки
+        auto heartbeat = conf::heartbeat();
+        if (heartbeat && (now - write_time_ >= milliseconds(heartbeat)))
+        {
+            auto rc = ::send(socket_.fd(), "\n", 1, MSG_DONTWAIT|MSG_NOSIGNAL);
+            if ((rc != 1) && !btpro::socket::wouldblock())
+                return false;
+
+            write_time_ = now;
+        }
+
+        return true;
+    }
+    catch (...)
+    {   }
+
+    return false;
+}
+
+void connection::update_latency(cluster::clock::duration value) noexcept
+{
+    pool_.nodes().latency(node_, value);
+}
+
 void connection::trace_frame(std::string frame)
 {
     capst_journal.trace([&]{
@@ -660,10 +1455,76 @@ void connection::trace_packet(const stompconn::packet& packet)
     }
 }
 
-std::size_t connection::send_content(stompconn::send frame)
+void append_number(std::string& text, std::uint64_t value)
 {
-    CAPSTOMP_STATE(6);
+    char buf[24];
+    auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), value);
+    text.append(buf, end);
+}
+
+template<class F>
+std::size_t connection::resend(F fn)
+{
+    // сохраненный фрейм повторяется только после обрыва
+    if (!conf_.replay() || uri_.empty())
+        return fn();
+
+    std::string error;
+    try
+    {
+        return fn();
+    }
+    catch (const std::system_error& e)
+    {
+        error = e.what();
+    }
+    catch (const std::exception& e)
+    {
+        // ошибка брокера или таймаут на живом сокете
+        if (socket_.good())
+            throw;
+
+        error = e.what();
+    }
+
+    capst_journal.cerr([&]{
+        std::string text;
+        text.reserve(64);
+        text += "connection: reconnect to replay "sv;
+        text += std::to_string(replay_.size());
+        text += " frames - "sv;
+        text += error;
+        return text;
+    });
+
+    // текущий фрейм уже в окне, connect повторит его
+    close();
+
+    btpro::uri u(uri_);
+    connect(u);
+    confirm_logon();
+
+    auto rc = replay_.empty() ? 0 : replay_.back().data.size();
+
+    // окно повторено без квитанций, брокер обрабатывает фреймы по порядку
+    // квитанция на пустую транзакцию подтверждает все окно
+    auto mark = replay_seq_;
+    std::string barrier(replay_tag_);
+    barrier += "replay-"sv;
+    append_number(barrier, mark);
+    send(stompconn::begin(barrier), false);
+    send(stompconn::abort(barrier), true);
+    read("replay"sv);
+    if (!socket_.good())
+        throw std::runtime_error("disconnect: replay");
+
+    confirm_replay(mark);
+
+    return rc;
+}
 
+void connection::prepare_content(stompconn::send& frame)
+{
     // используем ли таймстамп
     if (conf_.timestamp())
         frame.push(stompconn::header::time_since_epoch());
@@ -671,58 +1532,547 @@ std::size_t connection::send_content(stompconn::send frame)
     if (conf_.persistent())
         frame.push(stompconn::header::persistent_on());
 
-    auto receipt = is_receipt();
     // используется ли транзакция
     if (!transaction_id_.empty())
-    {
         frame.push(stompconn::header::transaction(transaction_id_));
 
-        // подтверждения не используются при между (begin и commit)
-        // сбрасываем ожидание подтверждения
-        receipt = false;
-    }
-
-    auto rc = send(std::move(frame), receipt);
-    read("send_content"sv);
-    return rc;
+    if (conf_.replay())
+        frame.push(stompconn::header::make("message-id"sv, next_message_id()));
 }
 
-std::size_t connection::send(stompconn::buffer data)
+std::size_t connection::send_content(stompconn::send frame)
 {
-    auto rc = data.size();
-    do
+    CAPSTOMP_STATE(6);
+
+    // заголовки добавит соединение дорожки
+    if (with_affinity())
+        return pool_.send_affinity(lane_, conf_, uri_, std::move(frame));
+
+    prepare_content(frame);
+
+    // асинхронный режим только копирует фрейм в очередь
+    if (sender_)
     {
-        auto ev = ready(POLLIN|POLLOUT,
-            static_cast<int>(conf::timeout()));
-        // сокет неожиданно стал доступен на запись
-        // а мы ничего не ждем
-        if (ev & POLLIN)
-        {
-            if (!read_stomp("send"sv))
-            {
-                close();
+        auto data = frame.str();
+        auto rc = data.size();
+        return sender_->push(std::move(data)) ? rc : 0;
+    }
 
-                if (!error_.empty())
-                    error_ = "disconnect"sv;
-            }
+    // подтверждения не используются при между (begin и commit)
+    // сбрасываем ожидание подтверждения
+    auto receipt = transaction_id_.empty() ? is_receipt() : false;
 
-            throw std::runtime_error("protocol error");
-        }
+    if (conf_.replay())
+        keep(frame.str());
 
-        if (ev & POLLOUT)
-        {
-            auto rc = data.write(socket_.fd());
-            if (btpro::code::fail == rc)
+    return resend([&]{
+        return send_frame(std::move(frame), receipt);
+    });
+}
+
+std::size_t connection::send_frame(stompconn::send frame, bool receipt)
+{
+    // копим фреймы до порога или до конца запроса
+    if (conf_.cork() && !receipt)
+    {
+        if (capst_journal.allow_trace())
+            trace_frame(frame.str());
+
+        auto data = frame.str();
+        auto rc = data.size();
+        output_ += data;
+        if (output_.size() >= conf::cork_size())
+            flush();
+
+        ++total_count_;
+
+        confirm_logon();
+
+        return rc;
+    }
+
+    if (receipt && (conf::receipt_window() > 1))
+    {
+        auto rc = send_windowed(std::move(frame));
+        confirm_logon();
+        return rc;
+    }
+
+    auto rc = send(std::move(frame), receipt);
+    confirm_logon();
+    read("send_content"sv);
+
+    // брокер обрабатывает фреймы по порядку
+    if (receipt)
+        confirm_replay(replay_seq_);
+
+    return rc;
+}
+
+std::size_t connection::send_windowed(stompconn::send frame)
+{
+    // окно заполнено - ждем самую старую квитанцию
+    auto window = std::min(conf::receipt_window(), receipt_ring_size);
+    wait_receipts(window - 1);
+
+    auto seq = receipt_next_++;
+    auto& slot = receipt_ring_[seq % receipt_ring_size];
+    slot.time = cluster::clock::now();
+    slot.replay = replay_seq_;
+    slot.done = false;
+
+    // обработчик хранит только this и номер квитанции
+    // и помещается во внутренний буфер std::function без аллокации
+    stomplay_.add_handler(frame, [this, seq](stompconn::packet packet){
+        on_receipt(seq, packet);
+    });
+
+    if (capst_journal.allow_trace())
+        trace_frame(frame.str());
+
+    auto rc = send(frame.data());
+
+    // забираем уже пришедшие ответы не блокируясь
+    while (receipt_outstanding() && ready_read(0))
+    {
+        if (!read_stomp("receipt"sv))
+        {
+            close();
+            throw std::runtime_error("disconnect: receipt");
+        }
+    }
+
+    if (!error_.empty())
+        throw std::runtime_error(error_);
+
+    return rc;
+}
+
+void connection::on_receipt(std::size_t seq,
+    const stompconn::packet& packet) noexcept
+{
+    // ответ для закрытого сокета
+    if ((seq < receipt_head_) || (seq >= receipt_next_))
+        return;
+
+    auto& slot = receipt_ring_[seq % receipt_ring_size];
+    slot.done = true;
+
+    if (!packet)
+        error_ = packet.payload().str();
+    else
+        confirm_replay(slot.replay);
+
+    trace_packet(packet);
+
+    if (node_ != cluster::npos)
+        update_latency(cluster::clock::now() - slot.time);
+
+    // сдвигаем окно по подтвержденным подряд
+    while ((receipt_head_ < receipt_next_) &&
+        receipt_ring_[receipt_head_ % receipt_ring_size].done)
+    {
+        ++receipt_head_;
+    }
+}
+
+void connection::wait_receipts(std::size_t limit)
+{
+    while (receipt_outstanding() > limit)
+    {
+        if (ready_read(poll_timeout("receipt"sv)))
+        {
+            if (!read_stomp("receipt"sv))
             {
-                // проверяем на блокировку операции
-                if (!btpro::socket::wouldblock())
-                    throw std::system_error(btpro::net::error_code(), "send");
+                close();
+                throw std::runtime_error("disconnect: receipt");
             }
         }
         else
-            throw std::runtime_error("send timeout");
+            throw std::runtime_error("timeout: receipt");
     }
-    while (!data.empty());
+
+    if (!error_.empty())
+        throw std::runtime_error(error_);
+}
+
+void connection::drain_receipts() noexcept
+{
+    if (!receipt_outstanding())
+        return;
+
+    try
+    {
+        wait_receipts(0);
+        return;
+    }
+    catch (const std::exception& e)
+    {
+        capst_journal.cerr([&]{
+            std::string text;
+            text.reserve(64);
+            text += "connection: receipts - "sv;
+            text += e.what();
+            return text;
+        });
+    }
+    catch (...)
+    {
+        capst_journal.cerr([&]{
+            return "connection: receipts";
+        });
+    }
+
+    // пул не сохранит закрытое соединение
+    close();
+}
+
+std::string connection::make_content(stompconn::send frame)
+{
+    prepare_content(frame);
+
+    return frame.str();
+}
+
+std::size_t connection::send_content(std::string data, std::size_t count,
+    std::size_t last)
+{
+    CAPSTOMP_STATE(6);
+
+    // пачка уходит в очередь одним элементом
+    if (sender_)
+    {
+        auto rc = data.size();
+        return sender_->push(std::move(data), count) ? rc : 0;
+    }
+
+    // окно повтора хранит фреймы без квитанций
+    if (conf_.replay())
+        keep(data);
+
+    // одна квитанция на последний фрейм группы
+    // брокер обрабатывает фреймы по порядку
+    auto receipt = with_receipt();
+    if (receipt)
+        expect_receipt(data, last);
+
+    return resend([&]{
+        auto rc = data.size();
+
+        iovec iov[] = {
+            { data.data(), data.size() }
+        };
+
+        // накопленные фреймы уходят первыми
+        write_output(iov, 1);
+
+        // число отправок
+        total_count_ += count;
+
+        confirm_logon();
+
+        if (receipt)
+        {
+            read("send_content"sv);
+            confirm_replay(replay_seq_);
+        }
+
+        return rc;
+    });
+}
+
+void connection::expect_receipt(stompconn::frame& frame)
+{
+    // запускаем ожидание приема
+    receipt_received_ = false;
+
+    auto start = cluster::clock::now();
+    stomplay_.add_handler(frame, [&, start](stompconn::packet packet){
+        // квитанция получена в любом случае
+        receipt_received_ = true;
+
+        if (node_ != cluster::npos)
+            update_latency(cluster::clock::now() - start);
+
+        if (!packet)
+            error_ = packet.payload().str();
+
+        trace_packet(packet);
+    });
+}
+
+void connection::expect_receipt(std::string& data, std::size_t pos)
+{
+    // номер квитанции выдает stomplay, берем его заголовок из пустого фрейма
+    stompconn::send probe(std::string_view{});
+    expect_receipt(probe);
+
+    constexpr auto tag = "\nreceipt:"sv;
+    auto text = probe.str();
+    auto from = text.find(tag);
+    if (from == std::string::npos)
+        throw std::runtime_error("receipt: no header");
+
+    ++from;
+    auto to = text.find('\n', from);
+    if (to == std::string::npos)
+        throw std::runtime_error("receipt: bad header");
+
+    // заголовок идет сразу за строкой команды
+    auto command = data.find('\n', pos);
+    if (command == std::string::npos)
+        throw std::runtime_error("receipt: bad frame");
+
+    data.insert(command + 1, text, from, to - from + 1);
+}
+
+const std::string& connection::next_message_id()
+{
+    message_id_ = replay_tag_;
+    append_number(message_id_, ++replay_seq_);
+    return message_id_;
+}
+
+void connection::keep(std::string data)
+{
+    replay_bytes_ += data.size();
+    replay_.push_back({ replay_seq_, std::move(data) });
+
+    // окно ограничено, старые фреймы теряют гарантию доставки
+    auto limit = conf::replay_size();
+    while ((replay_bytes_ > limit) && (replay_.size() > 1))
+    {
+        replay_bytes_ -= replay_.front().data.size();
+        replay_.pop_front();
+
+        if (!replay_overflow_)
+        {
+            replay_overflow_ = true;
+            capst_journal.cerr([&]{
+                std::string text;
+                text.reserve(64);
+                text += "connection: replay window overflow, size="sv;
+                text += std::to_string(limit);
+                return text;
+            });
+        }
+    }
+}
+
+void connection::confirm_replay(std::size_t mark) noexcept
+{
+    while (!replay_.empty() && (replay_.front().seq <= mark))
+    {
+        replay_bytes_ -= replay_.front().data.size();
+        replay_.pop_front();
+    }
+
+    if (replay_.empty())
+        replay_overflow_ = false;
+}
+
+void connection::replay()
+{
+    if (replay_.empty())
+        return;
+
+    capst_journal.cout([&]{
+        std::string text;
+        text.reserve(64);
+        text += "connection: socket="sv;
+        text += std::to_string(socket_.fd());
+        text += " replay="sv;
+        text += std::to_string(replay_.size());
+        text += " bytes="sv;
+        text += std::to_string(replay_bytes_);
+        return text;
+    });
+
+    // по частям, чтобы не превысить IOV_MAX
+    constexpr std::size_t chunk = 256u;
+    std::vector<iovec> iov;
+    iov.reserve(std::min(replay_.size(), chunk));
+    for (auto& f : replay_)
+    {
+        iov.push_back({ f.data.data(), f.data.size() });
+        if (iov.size() == chunk)
+        {
+            write(iov.data(), iov.size());
+            iov.clear();
+        }
+    }
+
+    if (!iov.empty())
+        write(iov.data(), iov.size());
+}
+
+void connection::render(const frame& f, std::size_t content_length)
+{
+    // строка переиспользует память между вызовами
+    header_ = f.head();
+
+    if (conf_.timestamp())
+    {
+        using namespace std::chrono;
+        auto now = system_clock::now().time_since_epoch();
+        header_ += "timestamp:"sv;
+        append_number(header_,
+            static_cast<std::uint64_t>(duration_cast<milliseconds>(now).count()));
+        header_ += '\n';
+    }
+
+    if (conf_.persistent())
+        header_ += "persistent:true\n"sv;
+
+    if (!transaction_id_.empty())
+    {
+        header_ += "transaction:"sv;
+        header_ += transaction_id_;
+        header_ += '\n';
+    }
+
+    if (conf_.replay())
+    {
+        header_ += "message-id:"sv;
+        header_ += next_message_id();
+        header_ += '\n';
+    }
+
+    header_ += "content-length:"sv;
+    append_number(header_, content_length);
+    header_ += "\n\n"sv;
+
+    if (capst_journal.allow_trace())
+        trace_frame(header_);
+}
+
+bool connection::with_receipt() noexcept
+{
+    // очередь и транзакции квитанций не используют
+    if (sender_ || !transaction_id_.empty())
+        return false;
+
+    return is_receipt();
+}
+
+std::size_t connection::send_content(const frame& f, std::string_view body)
+{
+    CAPSTOMP_STATE(6);
+
+    render(f, body.size());
+
+    auto rc = header_.size() + body.size() + 1;
+
+    if (sender_)
+    {
+        std::string data;
+        data.reserve(rc);
+        data += header_;
+        data += body;
+        data += '\0';
+        return sender_->push(std::move(data)) ? rc : 0;
+    }
+
+    if (conf_.replay())
+    {
+        std::string data;
+        data.reserve(rc);
+        data += header_;
+        data += body;
+        data += '\0';
+        keep(std::move(data));
+    }
+
+    return resend([&]{
+        if (conf_.cork())
+        {
+            output_ += header_;
+            output_ += body;
+            output_ += '\0';
+            if (output_.size() >= conf::cork_size())
+                flush();
+
+            ++total_count_;
+
+            confirm_logon();
+
+            return rc;
+        }
+
+        static const char eof[] = {'\0'};
+
+        // заголовки, тело из памяти аргумента и завершающий ноль
+        // одним вызовом sendmsg без копирования
+        iovec iov[] = {
+            { const_cast<char*>(header_.data()), header_.size() },
+            { const_cast<char*>(body.data()), body.size() },
+            { const_cast<char*>(eof), sizeof(eof) }
+        };
+
+        // накопленные фреймы уходят первыми в том же вызове
+        write_output(iov, sizeof(iov) / sizeof(iov[0]));
+
+        // число отправок
+        ++total_count_;
+
+        confirm_logon();
+
+        return rc;
+    });
+}
+
+std::size_t connection::append_content(std::string& data,
+    const frame& f, std::string_view body)
+{
+    render(f, body.size());
+
+    auto rc = header_.size() + body.size() + 1;
+
+    data += header_;
+    data += body;
+    data += '\0';
+
+    return rc;
+}
+
+std::size_t connection::send_batch(iovec* iov, std::size_t count,
+    std::size_t frames)
+{
+    CAPSTOMP_STATE(6);
+
+    capst_journal.trace([&]{
+        std::string text;
+        text.reserve(64);
+        text += "connection: socket="sv;
+        text += std::to_string(socket_.fd());
+        text += " send batch="sv;
+        text += std::to_string(count);
+        return text;
+    });
+
+    std::size_t rc = 0;
+    for (std::size_t i = 0; i < count; ++i)
+        rc += iov[i].iov_len;
+
+    // накопленные фреймы уходят первыми
+    write_output(iov, count);
+
+    // число отправок, элемент очереди может быть пачкой
+    total_count_ += frames;
+
+    confirm_logon();
+
+    return rc;
+}
+
+std::size_t connection::send(stompconn::buffer data)
+{
+    auto rc = data.size();
+
+    // накопленные фреймы уходят первыми
+    flush();
+
+    write(std::move(data));
 
     // число отправок
     ++total_count_;
@@ -730,6 +2080,158 @@ std::size_t connection::send(stompconn::buffer data)
     return rc;
 }
 
+void connection::flush()
+{
+    if (output_.empty())
+        return;
+
+    capst_journal.trace([&]{
+        std::string text;
+        text.reserve(64);
+        text += "connection: socket="sv;
+        text += std::to_string(socket_.fd());
+        text += " flush="sv;
+        text += std::to_string(output_.size());
+        return text;
+    });
+
+    iovec iov[] = {
+        { output_.data(), output_.size() }
+    };
+
+    write(iov, 1);
+
+    output_.clear();
+}
+
+void connection::write_output(iovec* iov, std::size_t count)
+{
+    if (output_.empty())
+    {
+        write(iov, count);
+        return;
+    }
+
+    std::vector<iovec> v;
+    v.reserve(count + 1);
+    v.push_back({ output_.data(), output_.size() });
+    v.insert(v.end(), iov, iov + count);
+
+    write(v.data(), v.size());
+
+    output_.clear();
+}
+
+void connection::flush_output() noexcept
+{
+    try
+    {
+        flush();
+        return;
+    }
+    catch (const std::exception& e)
+    {
+        capst_journal.cerr([&]{
+            std::string text;
+            text.reserve(64);
+            text += "connection: flush - "sv;
+            text += e.what();
+            return text;
+        });
+    }
+    catch (...)
+    {
+        capst_journal.cerr([&]{
+            return "connection: flush";
+        });
+    }
+
+    // пул не сохранит закрытое соединение
+    close();
+}
+
+void connection::write(stompconn::buffer data)
+{
+    while (!data.empty())
+    {
+        auto rc = data.write(socket_.fd());
+        if (btpro::code::fail == rc)
+        {
+            // проверяем на блокировку операции
+            if (!btpro::socket::wouldblock())
+                throw std::system_error(btpro::net::error_code(), "send");
+
+            wait_write();
+        }
+    }
+}
+
+void connection::wait_write()
+{
+    auto ev = ready(POLLIN|POLLOUT, poll_timeout("send"sv));
+    // пока буфер сокета полон, брокер шлет heart-beat,
+    // квитанции окна и ответ на CONNECT, их обработают обработчики
+    if (ev & POLLIN)
+    {
+        if (!read_stomp("send"sv))
+        {
+            close();
+            throw std::runtime_error("disconnect: send");
+        }
+
+        // ERROR от брокера
+        if (!error_.empty())
+            throw std::runtime_error(error_);
+
+        // запись повторится, при занятом сокете вернемся сюда
+        return;
+    }
+
+    if (!(ev & POLLOUT))
+        throw std::runtime_error("send timeout");
+}
+
+void connection::write(iovec* iov, std::size_t count)
+{
+    msghdr msg{};
+
+    while (count)
+    {
+        msg.msg_iov = iov;
+        msg.msg_iovlen = std::min(count, static_cast<std::size_t>(IOV_MAX));
+
+        // пишем сразу, poll только если сокет не готов
+        auto rc = ::sendmsg(socket_.fd(), &msg, MSG_NOSIGNAL);
+        if (btpro::code::fail == rc)
+        {
+            if (errno == EINTR)
+                continue;
+
+            // проверяем на блокировку операции
+            if (!btpro::socket::wouldblock())
+                throw std::system_error(btpro::net::error_code(), "sendmsg");
+
+            wait_write();
+            continue;
+        }
+
+        // пропускаем записанное
+        auto size = static_cast<std::size_t>(rc);
+        while (count && (size >= iov->iov_len))
+        {
+            size -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+
+        if (count)
+        {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + size;
+            iov->iov_len -= size;
+        }
+    }
+}
+
 std::size_t connection::send(stompconn::logon frame)
 {
     // опрация логона всегда ожидает ответ
@@ -3,6 +3,8 @@
 #include "journal.hpp"
 #include "settings.hpp"
 #include "transaction.hpp"
+#include "frame.hpp"
+#include "cluster.hpp"
 
 #include "stompconn/stomplay.hpp"
 #include "stompconn/frame.hpp"
@@ -10,30 +12,75 @@
 #include "btpro/socket.hpp"
 #include "btpro/buffer.hpp"
 
-#include <list>
+#include <array>
+#include <deque>
 #include <mutex>
 #include <cassert>
 #include <atomic>
+#include <future>
+#include <thread>
+#include <stdexcept>
+#include <cstdint>
+
+struct iovec;
 
 namespace capst {
 
 class pool;
+class sender;
+
+// срок вызова udf исчерпан, к отказам брокера не относится
+class deadline_error
+    : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
 class connection
 {
 public:
-    using list_type = std::list<connection>;
-    using connection_id_type = list_type::iterator;
+    // адрес соединения в хранилище пула постоянный
+    using connection_id_type = connection*;
+
+    // номер транзакции в кольце пула, 0 - нет транзакции
+    using transaction_id_type = std::uint64_t;
 
-    using transaction_type = transaction<std::string, connection_id_type>;
-    using transaction_store_type = std::list<transaction_type>;
-    using transaction_id_type = transaction_store_type::iterator;
+    // закрепление соединения за потоком mysql
+    enum park_type : int
+    {
+        // используется
+        unparked = 0,
+        // ждет свой поток в его слоте
+        parked,
+        // отозвано пулом, поток должен вернуть его
+        revoked
+    };
+
+    // положение соединения в пуле
+    enum slot_type : int
+    {
+        // закрыто, слот свободен
+        slot_free = 0,
+        // в стеке готовых
+        slot_ready,
+        // выдано потоку
+        slot_active,
+        // в стеке готовых, проверяется монитором
+        slot_check
+    };
 
 private:
     pool& pool_;
     // настройки коннекта
     settings conf_;
-    // указатель на позицию в пуле коннектов
-    connection_id_type self_{};
+    // номер в хранилище пула
+    const std::size_t index_{};
+    // номер + 1 следующего соединения в стеке пула
+    std::atomic<std::uint32_t> next_{};
+    std::atomic<int> slot_{slot_free};
+    // копия дескриптора для статуса без блокировок
+    std::atomic<int> fd_{-1};
 
     // название транзакции
     std::string transaction_id_{};
@@ -45,22 +92,125 @@ private:
     std::size_t receipt_seq_{};
     bool receipt_received_{true};
 
+    // окно квитанций, ответы разбираются по мере прихода
+    static constexpr std::size_t receipt_ring_size = 128u;
+    struct receipt_slot
+    {
+        cluster::clock::time_point time{};
+        // последний сохраненный для повтора фрейм на момент отправки
+        std::size_t replay{};
+        bool done{};
+    };
+    std::array<receipt_slot, receipt_ring_size> receipt_ring_{};
+    // номер следующей квитанции и самой старой ожидаемой
+    std::size_t receipt_next_{};
+    std::size_t receipt_head_{};
+
+    // фреймы без квитанции для повтора после переподключения
+    struct replay_frame
+    {
+        std::size_t seq{};
+        std::string data{};
+    };
+    std::deque<replay_frame> replay_{};
+    std::size_t replay_seq_{};
+    std::size_t replay_bytes_{};
+    bool replay_overflow_{};
+    // префикс message-id соединения и текущий message-id
+    std::string replay_tag_{};
+    std::string message_id_{};
+
+    // запрошенный и согласованный интервал heart-beat брокера, мс
+    std::size_t heartbeat_ask_{};
+    std::size_t heartbeat_in_{};
+    // возврат в пул, последние чтение и запись в простое
+    cluster::clock::time_point idle_time_{};
+    cluster::clock::time_point read_time_{};
+    cluster::clock::time_point write_time_{};
+
     std::size_t passhash_{};
     std::string destination_{};
 
     btpro::socket socket_{};
     stompconn::stomplay stomplay_{};
 
-    std::size_t total_count_{};
+    // узел кластера брокеров, к которому подключены
+    std::size_t node_{cluster::npos};
+    cluster::clock::time_point connect_time_{};
+
+    // отложенное до первого фрейма подключение
+    std::string uri_{};
+    bool pending_{};
+    std::future<void> establish_{};
+    // BEGIN уходит с первым фреймом
+    // с pipeline=1 и CONNECT не ждет ответа, его проверит первый фрейм
+    bool pipeline_{};
+    // вход не проверен и получен ли ответ на CONNECT
+    bool handshake_{};
+    bool logon_received_{};
+
+    // срок завершения текущего вызова udf
+    cluster::clock::time_point deadline_{cluster::clock::time_point::max()};
+
+    // очередь пула для асинхронной отправки
+    sender* sender_{};
+    // дорожка affinity для текущего фрейма
+    std::size_t lane_{};
+
+    // накопленные фреймы в режиме cork
+    std::string output_{};
+
+    // заголовки фрейма собранного по заготовке
+    std::string header_{};
+
+    std::atomic<std::size_t> total_count_{};
     std::size_t request_count_{};
+
+    std::atomic<int> park_{unparked};
+    // поток, взявший соединение из пула
+    std::thread::id thread_{};
 #ifdef CAPSTOMP_STATE_DEBUG
     std::atomic<std::size_t> state_{};
 #endif // CAPSTOMP_STATE_DEBUG
 
-    btpro::socket create_connection(const btpro::uri& u, int timeout);
+    btpro::socket create_connection(const std::string& host,
+        int port, int timeout);
+
+    // подключение к одному из узлов кластера
+    void connect_node(const btpro::uri& u, cluster& nodes);
+
+    // сокет подключен к тому же брокеру и не требует пересоздания
+    bool reusable(const btpro::uri& u);
+
+    // проверка ответа на CONNECT после первой отправки
+    void confirm_logon();
+
+    // накопленные фреймы и новые данные одной записью
+    void write_output(iovec* iov, std::size_t count);
+
+    // следующий message-id для отбрасывания повторов брокером
+    const std::string& next_message_id();
+
+    // сохранить фрейм до квитанции
+    void keep(std::string data);
+
+    // квитанция подтвердила фреймы до mark включительно
+    void confirm_replay(std::size_t mark) noexcept;
+
+    // отправить сохраненные фреймы в новый сокет
+    void replay();
+
+    // при обрыве переподключиться и повторить окно
+    template<class F>
+    std::size_t resend(F fn);
+
+    std::size_t send_frame(stompconn::send frame, bool receipt);
+
+    // таймаут ожидания с учетом срока вызова
+    int poll_timeout(std::string_view what) const;
 public:
 
-    connection(pool& pool);
+    connection(pool& pool, std::size_t index);
 
     ~connection();
 
@@ -68,12 +218,61 @@ public:
 
     void init(const settings& conf) noexcept;
 
+    // отсчет срока вызова, ожидания внутри него не превысят срок
+    void start_deadline() noexcept;
+
     void connect(const btpro::uri& u);
 
+    // подключение и вход без начала транзакции
+    void open(const btpro::uri& u);
+
+    // подключение откладывается до первого фрейма
+    void prepare(const btpro::uri& u, const std::string& uri);
+
+    // дождаться отложенного подключения
+    void establish();
+
+    // отказ от отложенного подключения
+    void abandon() noexcept;
+
+    bool pending() const noexcept
+    {
+        return pending_;
+    }
+
+    // вместо подключения используем очередь пула
+    void connect_async(const btpro::uri& u, const std::string& uri);
+
+    // фреймы уходят через дорожки пула по ключу
+    void connect_affinity(const btpro::uri& u, const std::string& uri);
+
+    // выбрать дорожку для следующего фрейма
+    void route(std::string_view key) noexcept;
+
     std::size_t send_content(stompconn::send frame);
 
-    // задание указателя соединение в хранилище подключений
-    void set(connection_id_type self) noexcept;
+    // сериализовать фрейм со всеми заголовками соединения
+    std::string make_content(stompconn::send frame);
+
+    // отправить накопленные фреймы одной записью
+    // с receipt=1 квитанцию получает фрейм группы, начинающийся с last
+    std::size_t send_content(std::string data, std::size_t count,
+        std::size_t last);
+
+    // отправка по заготовке фрейма, тело передается по ссылке
+    std::size_t send_content(const frame& f, std::string_view body);
+
+    // дописать фрейм по заготовке в буфер пачки
+    std::size_t append_content(std::string& data,
+        const frame& f, std::string_view body);
+
+    // нужна ли квитанция на очередной фрейм
+    bool with_receipt() noexcept;
+
+    // отправка пачки готовых фреймов из очереди пула
+    // count элементов iov, frames фреймов в них
+    std::size_t send_batch(iovec* iov, std::size_t count,
+        std::size_t frames);
 
     // задание указателя на выполняемую транзакцию
     void set(transaction_id_type transaction_id) noexcept;
@@ -84,6 +283,12 @@ public:
     // выполнить комиты без проверки последовательности
     void force_commit();
 
+    // транзакция сессии mysql от capstomp_begin до capstomp_commit
+    void begin_session(const btpro::uri& u);
+
+    // COMMIT или ABORT и возврат соединения
+    void end_session(bool commit);
+
     // вернуть соединение
     void release();
 
@@ -104,9 +309,64 @@ public:
 
     std::size_t total_count() const noexcept
     {
-        return total_count_;
+        return total_count_.load(std::memory_order_relaxed);
+    }
+
+    int fd() const noexcept
+    {
+        return fd_.load(std::memory_order_relaxed);
+    }
+
+    std::size_t index() const noexcept
+    {
+        return index_;
+    }
+
+    std::uint32_t next() const noexcept
+    {
+        return next_.load(std::memory_order_relaxed);
+    }
+
+    void set_next(std::uint32_t next) noexcept
+    {
+        next_.store(next, std::memory_order_relaxed);
+    }
+
+    int slot() const noexcept
+    {
+        return slot_.load(std::memory_order_relaxed);
+    }
+
+    void set_slot(int slot) noexcept
+    {
+        slot_.store(slot, std::memory_order_release);
+    }
+
+    // смена положения, которое может занять монитор
+    bool move_slot(int from, int to) noexcept
+    {
+        return slot_.compare_exchange_weak(from, to,
+            std::memory_order_acquire, std::memory_order_relaxed);
+    }
+
+    // соединение возвращено в пул
+    void set_idle(cluster::clock::time_point now) noexcept
+    {
+        idle_time_ = read_time_ = write_time_ = now;
     }
 
+    cluster::clock::time_point idle_time() const noexcept
+    {
+        return idle_time_;
+    }
+
+    // обслуживание простаивающего соединения монитором
+    // false если соединение мертво
+    bool heartbeat(cluster::clock::time_point now) noexcept;
+
+    // ждать пока ожидаемых квитанций не станет не больше limit
+    void wait_receipts(std::size_t limit);
+
     const std::string& destination() const noexcept
     {
         return destination_;
@@ -117,11 +377,34 @@ public:
         return transaction_id_;
     }
 
+    // номер транзакции в кольце пула
+    transaction_id_type transaction() const noexcept
+    {
+        return transaction_;
+    }
+
+    // коммит отправлен, номер больше не нужен
+    transaction_id_type end_transaction() noexcept
+    {
+        auto rc = transaction_;
+        transaction_ = transaction_id_type();
+        return rc;
+    }
+
     bool with_transaction() const noexcept
     {
         return !transaction_id_.empty();
     }
 
+    // заголовок упорядочивания коммитов, пустой - порядок общий для пула
+    const std::string& order_by() const noexcept
+    {
+        return conf_.order_by();
+    }
+
+    // ключ фрейма транзакции, коммиты одного ключа идут по порядку
+    void order(std::string_view key) noexcept;
+
     std::string_view error() const noexcept
     {
         return error_;
@@ -132,17 +415,71 @@ public:
         return conf_.no_error();
     }
 
+    bool with_async() const noexcept
+    {
+        return conf_.async();
+    }
+
+    bool with_thread_cache() const noexcept
+    {
+        return conf_.thread_cache();
+    }
+
+    bool with_affinity() const noexcept
+    {
+        return !conf_.affinity().empty();
+    }
+
+    const std::string& affinity() const noexcept
+    {
+        return conf_.affinity();
+    }
+
+    // смена состояния закрепления, выполняется только одной стороной
+    bool park(int from, int to) noexcept
+    {
+        return park_.compare_exchange_strong(from, to);
+    }
+
+    void unpark() noexcept
+    {
+        park_.store(unparked);
+    }
+
+    int park_state() const noexcept
+    {
+        return park_.load();
+    }
+
+    // в слот потока закрепляет только взявший соединение поток
+    std::thread::id thread() const noexcept
+    {
+        return thread_;
+    }
+
+    connection_id_type self() noexcept
+    {
+        return this;
+    }
+
 private:
 
     bool connected();
 
-    void logon(const btpro::uri& u);
+    void logon(const btpro::uri& u, bool pipeline);
 
     void begin();
 
-    void commit_transaction(transaction_type& transaction, bool receipt);
+    void prepare_content(stompconn::send& frame);
 
-    std::size_t commit(transaction_store_type transaction_store);
+    void render(const frame& f, std::size_t content_length);
+
+    void commit_transaction(connection_id_type connection_id, bool receipt);
+
+    // COMMIT всех готовых транзакций и сбор квитанций одним poll
+    void commit_group(transaction_range range);
+
+    std::size_t commit(transaction_range range);
 
     bool ready_read(int timeout);
 
@@ -154,36 +491,54 @@ private:
 
     std::size_t send(stompconn::buffer buf);
 
+    void write(stompconn::buffer data);
+
+    void write(iovec* iov, std::size_t count);
+
+    void wait_write();
+
+    // отправить накопленные в режиме cork фреймы
+    void flush();
+
+    // сброс буфера без исключений перед коммитом
+    void flush_output() noexcept;
+
     std::size_t send(stompconn::logon frame);
 
     bool is_receipt() noexcept;
 
     void trace_frame(std::string frame);
 
+    void update_latency(cluster::clock::duration value) noexcept;
+
+    std::size_t receipt_outstanding() const noexcept
+    {
+        return receipt_next_ - receipt_head_;
+    }
+
+    // отправка с квитанцией без ожидания ответа
+    std::size_t send_windowed(stompconn::send frame);
+
+    void on_receipt(std::size_t seq, const stompconn::packet& packet) noexcept;
+
+    // дождаться всех квитанций перед возвратом в пул
+    void drain_receipts() noexcept;
+
     void trace_packet(const stompconn::packet& packet);
 
+    // запускаем ожидание квитанции, заголовок добавляется во фрейм
+    void expect_receipt(stompconn::frame& frame);
+
+    // квитанция для уже сериализованного фрейма в data с позиции pos
+    void expect_receipt(std::string& data, std::size_t pos);
+
     template<class T>
     std::size_t send(T frame, bool receipt)
     {
         if (receipt)
-        {
-            // запускаем ожидание приема
-            receipt_received_ = false;
-
-            stomplay_.add_handler(frame, [&](stompconn::packet packet){
-                // квитанция получена в любом случае
-                receipt_received_ = true;
-
-                if (!packet)
-                    error_ = packet.payload().str();
-
-                trace_packet(packet);
-            });
-        }
+            expect_receipt(frame);
         else
-        {
             receipt_received_ = true;
-        }
 
         if (capst_journal.allow_trace())
             trace_frame(frame.str());
@@ -0,0 +1,85 @@
+#include "connector.hpp"
+#include "journal.hpp"
+
+namespace capst {
+
+connector::~connector()
+{
+    {
+        lock l(mutex_);
+        stop_ = true;
+    }
+
+    cv_.notify_all();
+
+    for (auto& t : threads_)
+    {
+        if (t.joinable())
+            t.join();
+    }
+}
+
+std::future<void> connector::post(std::function<void()> fn)
+{
+    task t(std::move(fn));
+    auto rc = t.get_future();
+
+    {
+        lock l(mutex_);
+
+        // потоки запускаются при первой задаче
+        if (threads_.empty())
+        {
+            capst_journal.cout([]{
+                return "connector: start";
+            });
+
+            threads_.reserve(thread_count);
+            for (std::size_t i = 0; i < thread_count; ++i)
+            {
+                threads_.emplace_back([this]{
+                    run();
+                });
+            }
+        }
+
+        queue_.push_back(std::move(t));
+    }
+
+    cv_.notify_one();
+
+    return rc;
+}
+
+void connector::run() noexcept
+{
+    lock l(mutex_);
+    while (true)
+    {
+        cv_.wait(l, [&]{
+            return stop_ || !queue_.empty();
+        });
+
+        // ожидающие задачи получат broken_promise
+        if (stop_)
+            break;
+
+        auto t = std::move(queue_.front());
+        queue_.pop_front();
+
+        l.unlock();
+
+        // исключение задачи сохраняется в future
+        t();
+
+        l.lock();
+    }
+}
+
+connector& connector::inst() noexcept
+{
+    static connector i;
+    return i;
+}
+
+} // namespace capst
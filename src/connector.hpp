@@ -0,0 +1,43 @@
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <future>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+namespace capst {
+
+// фоновые задачи с ожиданием сети: отложенные подключения
+// и коммиты зависших цепочек, снятых монитором
+// несколько долгоживущих потоков вместо потока на каждую задачу
+class connector
+{
+    using lock = std::unique_lock<std::mutex>;
+    using task = std::packaged_task<void()>;
+
+    // одновременных задач
+    static constexpr std::size_t thread_count = 4u;
+
+    std::mutex mutex_{};
+    std::condition_variable cv_{};
+    std::list<task> queue_{};
+    std::vector<std::thread> threads_{};
+    bool stop_{};
+
+    connector() = default;
+
+    ~connector();
+
+    void run() noexcept;
+
+public:
+    // результат и исключение задачи вернет future
+    std::future<void> post(std::function<void()> fn);
+
+    static connector& inst() noexcept;
+};
+
+} // namespace capst
@@ -0,0 +1,49 @@
+#include "frame.hpp"
+
+using namespace std::literals;
+
+namespace capst {
+
+// экранирование заголовков по stomp 1.2
+void frame::append_escaped(std::string& text, std::string_view value)
+{
+    for (auto c : value)
+    {
+        switch (c)
+        {
+        case '\\':
+            text += "\\\\"sv;
+            break;
+        case '\n':
+            text += "\\n"sv;
+            break;
+        case '\r':
+            text += "\\r"sv;
+            break;
+        case ':':
+            text += "\\c"sv;
+            break;
+        default:
+            text += c;
+        }
+    }
+}
+
+void frame::assign(std::string_view destination)
+{
+    head_.clear();
+    head_.reserve(64 + destination.size());
+    head_ += "SEND\ndestination:"sv;
+    append_escaped(head_, destination);
+    head_ += '\n';
+}
+
+void frame::push(std::string_view key, std::string_view value)
+{
+    append_escaped(head_, key);
+    head_ += ':';
+    append_escaped(head_, value);
+    head_ += '\n';
+}
+
+} // namespace capst
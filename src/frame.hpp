@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+namespace capst {
+
+// заготовка фрейма SEND
+// командная строка, destination и постоянные заголовки
+// сериализуются один раз на запрос
+// на каждую строку добавляются только content-length и тело
+class frame
+{
+    std::string head_{};
+
+    static void append_escaped(std::string& text, std::string_view value);
+
+public:
+    frame() = default;
+
+    void assign(std::string_view destination);
+
+    void push(std::string_view key, std::string_view value);
+
+    void clear() noexcept
+    {
+        head_.clear();
+    }
+
+    bool empty() const noexcept
+    {
+        return head_.empty();
+    }
+
+    const std::string& head() const noexcept
+    {
+        return head_;
+    }
+};
+
+} // namespace capst
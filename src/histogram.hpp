@@ -0,0 +1,70 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <string>
+#include <cstdint>
+
+namespace capst {
+
+// гистограмма по степеням двойки
+// корзина i считает значения меньше 2^i, последняя - все остальные
+class histogram
+{
+public:
+    static constexpr std::size_t size = 20u;
+
+private:
+    std::array<std::atomic<std::uint64_t>, size> bucket_{};
+    std::atomic<std::uint64_t> count_{};
+    std::atomic<std::uint64_t> max_{};
+
+public:
+    histogram() = default;
+
+    void add(std::uint64_t value) noexcept
+    {
+        std::size_t i = 0;
+        while ((i + 1 < size) && (value >= (std::uint64_t{1} << i)))
+            ++i;
+
+        bucket_[i].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+
+        auto max = max_.load(std::memory_order_relaxed);
+        while ((value > max) && !max_.compare_exchange_weak(max, value,
+            std::memory_order_relaxed))
+        {   }
+    }
+
+    // хвост пустых корзин не выводим
+    std::string json() const
+    {
+        std::string rc;
+        rc.reserve(128);
+
+        std::size_t last = 0;
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            if (bucket_[i].load(std::memory_order_relaxed))
+                last = i + 1;
+        }
+
+        rc += "{\"count\":";
+        rc += std::to_string(count_.load(std::memory_order_relaxed));
+        rc += ",\"max\":";
+        rc += std::to_string(max_.load(std::memory_order_relaxed));
+        rc += ",\"log2\":[";
+        for (std::size_t i = 0; i < last; ++i)
+        {
+            if (i)
+                rc += ',';
+            rc += std::to_string(bucket_[i].load(std::memory_order_relaxed));
+        }
+        rc += "]}";
+
+        return rc;
+    }
+};
+
+} // namespace capst
@@ -0,0 +1,117 @@
+#include "monitor.hpp"
+#include "store.hpp"
+#include "session.hpp"
+#include "journal.hpp"
+#include "conf.hpp"
+
+#include <algorithm>
+
+using namespace std::literals;
+
+namespace capst {
+
+monitor::~monitor()
+{
+    {
+        lock l(mutex_);
+        stop_ = true;
+    }
+
+    cv_.notify_one();
+
+    if (thread_.joinable())
+        thread_.join();
+}
+
+std::chrono::milliseconds monitor::period() noexcept
+{
+    // чаще половины интервала нет смысла, реже секунды нельзя
+    auto heartbeat = conf::heartbeat();
+    auto rc = heartbeat ? heartbeat / 2 : std::size_t{1000u};
+    rc = std::max(rc, std::size_t{100u});
+    rc = std::min(rc, std::size_t{1000u});
+    return std::chrono::milliseconds(rc);
+}
+
+void monitor::start()
+{
+    if (started_.load(std::memory_order_acquire))
+        return;
+
+    lock l(mutex_);
+
+    if (started_.load(std::memory_order_relaxed))
+        return;
+
+    capst_journal.cout([]{
+        return "monitor: start";
+    });
+
+    thread_ = std::thread([this]{
+        run();
+    });
+
+    started_.store(true, std::memory_order_release);
+}
+
+bool monitor::active() noexcept
+{
+    return (conf::heartbeat() > 0) &&
+        inst().started_.load(std::memory_order_acquire);
+}
+
+void monitor::run() noexcept
+{
+    lock l(mutex_);
+    while (!stop_)
+    {
+        cv_.wait_for(l, period(), [&]{
+            return stop_;
+        });
+
+        if (stop_)
+            break;
+
+        l.unlock();
+
+        try
+        {
+            auto& pools = store::inst();
+            pools.each([](pool& p){
+                p.monitor(cluster::clock::now());
+            });
+
+            // удаленные пулы, чьи соединения вернулись после erase
+            pools.reclaim();
+
+            // транзакции сессий, брошенные вместе с потоком
+            session::expire(session::clock::now());
+        }
+        catch (const std::exception& e)
+        {
+            capst_journal.cerr([&]{
+                std::string text;
+                text.reserve(64);
+                text += "monitor: "sv;
+                text += e.what();
+                return text;
+            });
+        }
+        catch (...)
+        {
+            capst_journal.cerr([]{
+                return "monitor: error";
+            });
+        }
+
+        l.lock();
+    }
+}
+
+monitor& monitor::inst() noexcept
+{
+    static monitor i;
+    return i;
+}
+
+} // namespace capst
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <condition_variable>
+
+namespace capst {
+
+// фоновый поток обслуживания простаивающих соединений всех пулов
+// шлет heart-beat, разбирает входящие кадры и закрывает мертвые
+class monitor
+{
+    using lock = std::unique_lock<std::mutex>;
+
+    std::mutex mutex_{};
+    std::condition_variable cv_{};
+    std::thread thread_{};
+    std::atomic<bool> started_{};
+    bool stop_{};
+
+    monitor() = default;
+
+    ~monitor();
+
+    void run() noexcept;
+
+    // период обхода пулов
+    static std::chrono::milliseconds period() noexcept;
+
+public:
+    // запуск при первой необходимости
+    void start();
+
+    // соединения в пулах проверяет монитор
+    static bool active() noexcept;
+
+    static monitor& inst() noexcept;
+};
+
+} // namespace capst
@@ -1,24 +1,107 @@
 #include "pool.hpp"
+#include "connector.hpp"
 #include "conf.hpp"
 #include "journal.hpp"
 
 #include "btdef/text.hpp"
 
+#include <array>
+#include <thread>
 #include <memory>
 
 using namespace std::literals;
 
 namespace capst {
 
-std::string pool::create_transaction_id()
+static std::atomic<std::uint64_t> pool_seq{};
+
+// соединение, закрепленное за потоком mysql
+struct thread_slot
+{
+    std::uint64_t pool_id{};
+    std::size_t epoch{};
+    connection* conn{};
+    // пул не освобождается, пока соединение в слоте, см. held_size
+    pool* owner{};
+};
+
+// при завершении потока закрепленные соединения возвращаются в пул
+struct thread_slot_list
+{
+    std::array<thread_slot, 8> slot{};
+
+    ~thread_slot_list()
+    {
+        for (auto& s : slot)
+        {
+            if (s.conn)
+                s.owner->release_parked(s.conn);
+        }
+    }
+};
+
+static thread_local thread_slot_list thread_slots{};
+
+static thread_slot* find_slot(std::uint64_t pool_id) noexcept
 {
-    return std::to_string(++transaction_seq_) + '@' + name_;
+    for (auto& s : thread_slots.slot)
+    {
+        if (s.pool_id == pool_id)
+            return &s;
+    }
+    return nullptr;
+}
+
+// nullptr если все слоты заняты соединениями других пулов
+// вытеснять нельзя, соединение осталось бы выданным навсегда
+static thread_slot* select_slot(std::uint64_t pool_id) noexcept
+{
+    thread_slot* empty = nullptr;
+    for (auto& s : thread_slots.slot)
+    {
+        // отозванное при clear или erase соединение возвращаем сразу
+        // пул не освобождается, пока оно занимает слот
+        if (s.conn && (s.conn->park_state() == connection::revoked))
+        {
+            s.owner->release_parked(std::exchange(s.conn, nullptr));
+            s.owner = nullptr;
+        }
+
+        if (s.pool_id == pool_id)
+            return &s;
+
+        if (!empty && !s.conn)
+            empty = &s;
+    }
+
+    if (empty)
+        *empty = thread_slot{pool_id, 0, nullptr, nullptr};
+
+    return empty;
 }
 
 void pool::clear() noexcept
 {
     try
     {
+        // дорожки отдаем до мутекса пула
+        // под мутексом дорожки get может его захватить
+        std::array<connection_id_type, lane_max> lanes{};
+        for (std::size_t i = 0; i < lanes_.size(); ++i)
+        {
+            std::lock_guard<std::mutex> g(lanes_[i].mutex);
+            lanes[i] = std::exchange(lanes_[i].conn, nullptr);
+        }
+
+        for (auto c : lanes)
+        {
+            if (c)
+            {
+                c->close();
+                c->commit();
+            }
+        }
+
         lock l(mutex_);
 
         capst_journal.trace([&]{
@@ -30,7 +113,19 @@ void pool::clear() noexcept
             text += std::to_string(ready_.size());
             return text;
         });
-        ready_.clear();
+
+        // объекты остаются в хранилище закрытыми
+        while (auto c = ready_.pop())
+        {
+            take_ready(*c, connection::slot_free);
+            if (!c->good() && !c->with_async())
+                --stale_;
+            c->close();
+            c->set_slot(connection::slot_free);
+            free_.push(c->index());
+        }
+
+        revoke();
     }
     catch (const std::exception& e)
     {
@@ -57,83 +152,184 @@ void pool::clear() noexcept
 }
 
 pool::pool()
+    : id_(++pool_seq)
 {
     name_ += btdef::to_hex(reinterpret_cast<std::uint64_t>(this));
 }
 
 pool::pool(const std::string& name)
     : name_(name)
+    , id_(++pool_seq)
 {   }
 
-connection& pool::get(const settings& conf)
+pool::~pool()
 {
-    auto max_pool_sockets = conf::max_pool_sockets();
+    if (warmup_.joinable())
+        warmup_.join();
+}
 
-    lock l(mutex_);
+void pool::revoke() noexcept
+{
+    ++epoch_;
 
-    auto i = ready_.begin();
-    if (i != ready_.end())
+    std::size_t count = 0;
+    auto size = slab_.size();
+    for (std::size_t i = 0; i < size; ++i)
     {
-        capst_journal.trace([&]{
+        auto& c = slab_[i];
+        if (c.slot() != connection::slot_active)
+            continue;
+
+        // поток не использует соединение
+        // закрываем сокет, объект вернет сам поток
+        if (c.park(connection::parked, connection::revoked))
+        {
+            c.close();
+            ++count;
+        }
+    }
+
+    if (count)
+    {
+        capst_journal.cout([&]{
             std::string text;
             text.reserve(64);
             text += "pool: "sv;
             text += name_;
-            text += " using an existing connection, ready: "sv;
-            text += std::to_string(ready_.size());
-            text += " active: "sv;
-            text += std::to_string(active_.size());
+            text += " revoke thread connections: "sv;
+            text += std::to_string(count);
             return text;
         });
-
-        active_.splice(active_.begin(), ready_, i);
     }
-    else
+}
+
+connection& pool::get(const settings& conf)
+{
+    if (conf.thread_cache())
     {
-        if (active_.size() >= max_pool_sockets)
+        // пул жив пока мы внутри store::get
+        // закрепленные соединения пул не уничтожает
+        auto s = find_slot(id_);
+        if (s && s->conn)
         {
-            throw std::runtime_error("pool: max pool sockets=" +
-                                     std::to_string(max_pool_sockets));
+            auto conn = std::exchange(s->conn, nullptr);
+            if ((s->epoch == epoch_.load()) &&
+                conn->park(connection::parked, connection::unparked))
+            {
+#ifdef CAPSTOMP_STATE_DEBUG
+                conn->set_state(1);
+#endif
+                conn->init(conf);
+                return *conn;
+            }
+
+            // соединение отозвано, возвращаем его пулу
+            release_parked(conn->self());
         }
+    }
+
+    auto conn = ready_.pop();
+    while (conn)
+    {
+        take_ready(*conn, connection::slot_active);
+
+        // монитор закрыл мертвое соединение, берем следующее
+        if (conn->good() || conn->with_async())
+            break;
+
+        --stale_;
+        conn->set_slot(connection::slot_free);
+        free_.push(conn->index());
+
+        conn = ready_.pop();
+    }
+
+    if (conn)
+    {
+        update_peak(++active_count_);
+
         capst_journal.trace([&]{
             std::string text;
             text.reserve(64);
             text += "pool: "sv;
             text += name_;
-            text += " create connection, active: "sv;
-            text += std::to_string(active_.size());
-            text += ", max="sv;
-            text += std::to_string(max_pool_sockets);
+            text += " using an existing connection, ready: "sv;
+            text += std::to_string(ready_.size());
+            text += " active: "sv;
+            text += std::to_string(active_count_.load());
             return text;
         });
-
-        active_.emplace_front(*this);
     }
-
-    // получаем соединение
-    auto& conn = active_.front();
+    else
+        conn = &create_connection(conf::max_pool_sockets());
 
 #ifdef CAPSTOMP_STATE_DEBUG
-    conn.set_state(1);
+    conn->set_state(1);
 #endif
 
-    // получаем указатель на соединение
-    auto connection_id = active_.begin();
-    // выставляем указатель
-    conn.set(connection_id);
-
     // сбрасываем параметры
     // передаем конфиг
-    conn.init(conf);
+    conn->init(conf);
 
-    return conn;
+    return *conn;
+}
+
+connection& pool::create_connection(std::size_t max_pool_sockets)
+{
+    // место резервируем до создания
+    auto active = active_count_.fetch_add(1);
+    if (active >= max_pool_sockets)
+    {
+        --active_count_;
+        throw std::runtime_error("pool: max pool sockets=" +
+                                 std::to_string(max_pool_sockets));
+    }
+
+    update_peak(active + 1);
+
+    capst_journal.trace([&]{
+        std::string text;
+        text.reserve(64);
+        text += "pool: "sv;
+        text += name_;
+        text += " create connection, active: "sv;
+        text += std::to_string(active);
+        text += ", max="sv;
+        text += std::to_string(max_pool_sockets);
+        return text;
+    });
+
+    // закрытые соединения используем повторно
+    auto conn = free_.pop();
+    if (conn)
+    {
+        conn->set_slot(connection::slot_active);
+        return *conn;
+    }
+
+    try
+    {
+        // хранилище растет только под мутексом
+        lock l(mutex_);
+        auto& rc = slab_[slab_.emplace(*this)];
+        rc.set_slot(connection::slot_active);
+        return rc;
+    }
+    catch (...)
+    {
+        --active_count_;
+        throw;
+    }
 }
 
 void pool::release_connection(connection_id_type connection_id)
 {
     auto pool_sockets = conf::pool_sockets();
 
-    if (connection_id->good() && (ready_.size() < pool_sockets))
+    // асинхронные соединения без сокета тоже сохраняем
+    // лишние готовые соединения закрывает монитор
+    auto keep = connection_id->good() || connection_id->with_async();
+    if (keep && (idle_size() < pool_sockets))
     {
 #ifdef CAPSTOMP_STATE_DEBUG
         connection_id->set_state(11);
@@ -147,7 +343,7 @@ void pool::release_connection(connection_id_type connection_id)
             text += " ready: "sv;
             text += std::to_string(ready_.size());
             text += " active: "sv;
-            text += std::to_string(active_.size());
+            text += std::to_string(active_count_.load());
             text += " store connection"sv;
             auto id = connection_id->transaction_id();
             if (!id.empty())
@@ -158,10 +354,11 @@ void pool::release_connection(connection_id_type connection_id)
             return text;
         });
 
-        // перемещаем соединенеи в список готовых к работе
-        ready_.splice(ready_.begin(), active_, connection_id);
-        auto& conn = ready_.front();
-        conn.set(ready_.begin());
+        // после push соединение может забрать другой поток
+        connection_id->set_idle(cluster::clock::now());
+        connection_id->set_slot(connection::slot_ready);
+        --active_count_;
+        ready_.push(connection_id->index());
     }
     else
     {
@@ -173,7 +370,7 @@ void pool::release_connection(connection_id_type connection_id)
             text += " ready: "sv;
             text += std::to_string(ready_.size());
             text += " active: "sv;
-            text += std::to_string(active_.size());
+            text += std::to_string(active_count_.load());
             text += " erase connection"sv;
             auto id = connection_id->transaction_id();
             if (!id.empty())
@@ -184,139 +381,612 @@ void pool::release_connection(connection_id_type connection_id)
             return text;
         });
 
-        active_.erase(connection_id);
+        // объект остается в хранилище
+        connection_id->close();
+        connection_id->set_slot(connection::slot_free);
+        --active_count_;
+        free_.push(connection_id->index());
     }
 }
 
 void pool::release(connection_id_type connection_id)
 {
-    lock l(mutex_);
+    auto& conn = *connection_id;
+
+    // коммит отправлен, слот кольца свободен
+    if (auto id = conn.end_transaction())
+        transactions_.done(id);
+
+    // коммит цепочки возвращает и соединения других потоков
+    if (conn.with_thread_cache() && conn.good() &&
+        (conn.thread() == std::this_thread::get_id()))
+    {
+        // оставляем соединение в слоте потока
+        // без мутекса, в списке active_ оно и так находится
+        auto s = select_slot(id_);
+        if (s && !s->conn)
+        {
+            s->epoch = epoch_.load();
+            s->conn = &conn;
+            s->owner = this;
+#ifdef CAPSTOMP_STATE_DEBUG
+            conn.set_state(11);
+#endif
+            conn.park(connection::unparked, connection::parked);
+            return;
+        }
+    }
 
     release_connection(connection_id);
 }
 
-pool::transaction_id_type pool::create_transaction(connection_id_type connection_id)
+void pool::release_parked(connection_id_type connection_id) noexcept
+{
+    try
+    {
+        // отзыв закрывает сокет под мутексом
+        lock l(mutex_);
+        connection_id->unpark();
+        release_connection(connection_id);
+    }
+    catch (...)
+    {   }
+}
+
+void pool::take_ready(connection& conn, int to) noexcept
+{
+    // монитор держит соединение недолго, только неблокирующие вызовы
+    while (!conn.move_slot(connection::slot_ready, to))
+        std::this_thread::yield();
+}
+
+void pool::monitor(cluster::clock::time_point now) noexcept
+{
+    using std::chrono::seconds;
+
+    // сглаженный пик одновременно выданных соединений
+    // по нему считаем сколько готовых держать
+    auto peak = peak_.exchange(active_count_.load());
+    peak_ewma_ += (static_cast<double>(peak) - peak_ewma_) / 16;
+
+    auto min_idle = min_idle_.load();
+    auto retain = static_cast<std::size_t>(peak_ewma_ + 0.5);
+    retain = std::max(retain, min_idle);
+    retain = std::min(retain, conf::pool_sockets());
+    retain_ = retain;
+
+    auto idle_timeout = seconds(conf::idle_timeout());
+    // недавно вернувшиеся не трогаем, они горячие
+    auto settle = seconds(2);
+
+    auto idle = idle_size();
+    std::size_t dead = 0;
+    std::size_t reaped = 0;
+    auto size = slab_.size();
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        auto& c = slab_[i];
+        // выданные потокам соединения не трогаем
+        if (!c.move_slot(connection::slot_ready, connection::slot_check))
+            continue;
+
+        if (c.good())
+        {
+            auto age = now - c.idle_time();
+            auto excess = idle > retain;
+            if (!c.heartbeat(now))
+                ++dead;
+            else if (((age > idle_timeout) && (idle > min_idle)) ||
+                (excess && (age > settle)))
+                ++reaped;
+            else
+            {
+                c.set_slot(connection::slot_ready);
+                continue;
+            }
+
+            // из стека не вынимаем, get отправит его в свободные
+            c.close();
+            ++stale_;
+            --idle;
+        }
+
+        c.set_slot(connection::slot_ready);
+    }
+
+    if (dead || reaped)
+    {
+        capst_journal.cout([&]{
+            std::string text;
+            text.reserve(64);
+            text += "pool: "sv;
+            text += name_;
+            text += " close dead: "sv;
+            text += std::to_string(dead);
+            text += " idle: "sv;
+            text += std::to_string(reaped);
+            text += " retain: "sv;
+            text += std::to_string(retain);
+            return text;
+        });
+    }
+
+    monitor_lanes(now);
+
+    expire_stuck(now);
+
+    // подключения долгие, выполняются в отдельном потоке
+    if (min_idle && (idle_size() < min_idle) && !warming_.exchange(true))
+    {
+        try
+        {
+            fill_idle(min_idle);
+        }
+        catch (const std::exception& e)
+        {
+            warming_ = false;
+
+            capst_journal.cerr([&]{
+                std::string text;
+                text.reserve(64);
+                text += "pool: "sv;
+                text += name_;
+                text += " fill idle - "sv;
+                text += e.what();
+                return text;
+            });
+        }
+    }
+}
+
+void pool::fill_idle(std::size_t count)
 {
     lock l(mutex_);
-    // создаем транзакцию
-    return transaction_store_.emplace(
-        transaction_store_.end(), create_transaction_id(), connection_id);
+
+    // предыдущий прогрев уже закончил работу
+    if (warmup_.joinable())
+        warmup_.join();
+
+    warmup_ = std::thread([this, uri = idle_uri_, count]{
+        try
+        {
+            warmup(uri, count);
+        }
+        catch (...)
+        {   }
+
+        warming_ = false;
+    });
 }
 
-// подтверждаем свою операцию и возвращаем список коммитов
-pool::transaction_store_type pool::get_uncommited(transaction_id_type i)
+void pool::keep_idle(std::size_t count, const std::string& uri)
 {
-    transaction_store_type rc;
+    // у пула может быть несколько uri с разными параметрами
+    // берем наибольший min_idle
+    if (count <= min_idle_.load(std::memory_order_relaxed))
+        return;
 
     lock l(mutex_);
+    if (count <= min_idle_)
+        return;
 
-#ifdef CAPSTOMP_TRACE_LOG
-        capst_journal.trace([&]{
+    idle_uri_ = uri;
+    min_idle_ = count;
+}
+
+std::size_t pool::warmup(const std::string& uri, std::size_t count)
+{
+    btpro::uri u(uri);
+    auto conf = settings::create_idle(u);
+
+    // сначала забираем соединения, чтобы не подключать одно дважды
+    std::vector<connection*> list;
+    list.reserve(count);
+    try
+    {
+        while (list.size() < count)
+            list.push_back(&get(conf));
+    }
+    catch (const std::exception& e)
+    {
+        capst_journal.cerr([&]{
             std::string text;
             text.reserve(64);
             text += "pool: "sv;
             text += name_;
-            text += " transaction:"sv;
-            text += i->id();
-            text += " ready"sv;
+            text += " warmup - "sv;
+            text += e.what();
             return text;
         });
-#endif
+    }
 
-    // в любом случае наша транзакция выполнена
-    // это должно вызываться внутри мутекса
-    i->set(true);
+    std::atomic<std::size_t> next{};
+    std::atomic<std::size_t> done{};
+    auto work = [&]{
+        for (auto i = next++; i < list.size(); i = next++)
+        {
+            auto conn = list[i];
+            try
+            {
+                conn->connect(u);
+                ++done;
+            }
+            catch (const std::exception& e)
+            {
+                conn->close();
 
-    // проверяем, является ли
-    // наша транзакция первой в списке
-    // если она не первая
-    // значит есть та, которая еще выполняется
-    auto b = transaction_store_.begin();
-    if (i != b)
+                capst_journal.cerr([&]{
+                    std::string text;
+                    text.reserve(64);
+                    text += "pool: "sv;
+                    text += name_;
+                    text += " warmup connect - "sv;
+                    text += e.what();
+                    return text;
+                });
+            }
+            catch (...)
+            {
+                conn->close();
+            }
+        }
+    };
+
+    // логон ждет ответа брокера, подключаем параллельно
+    std::vector<std::thread> threads;
+    auto thread_count = std::min(list.size(), std::size_t{8u});
+    try
     {
+        for (std::size_t i = 1; i < thread_count; ++i)
+            threads.emplace_back(work);
+    }
+    catch (...)
+    {   }
+
+    work();
+
+    for (auto& t : threads)
+        t.join();
+
+    // подключенные уходят в готовые
+    for (auto conn : list)
+        conn->commit();
+
+    capst_journal.cout([&]{
+        std::string text;
+        text.reserve(64);
+        text += "pool: "sv;
+        text += name_;
+        text += " warmup: "sv;
+        text += std::to_string(done.load());
+        text += " of "sv;
+        text += std::to_string(count);
+        return text;
+    });
+
+    return done;
+}
+
+sender& pool::async(const std::string& uri)
+{
+    lock l(mutex_);
+
+    if (!sender_)
+    {
+        auto capacity = conf::async_queue_size();
+
         capst_journal.cout([&]{
             std::string text;
             text.reserve(64);
             text += "pool: "sv;
             text += name_;
-            text += " transaction:"sv;
-            text += i->id();
-            text += " deffered commit: "sv;
-            text += std::to_string(std::distance(b, i));
-            for (auto d = b; d != i; ++d)
-            {
-                text += ' ';
-                text += "transaction:"sv;
-                text += d->id();
-            }
+            text += " create async sender, capacity="sv;
+            text += std::to_string(capacity);
             return text;
         });
 
-        // если наша транзакция не первая в списке
-        // просто говорим что мы законичли работу
-        // коммитить нашу транзакцию будет другой поток
-        // возвращаем пустой лист транзакций
+        sender_ = std::make_unique<sender>(*this, capacity);
+    }
+
+    sender_->set_uri(uri);
+
+    return *sender_;
+}
+
+std::size_t pool::send_affinity(std::size_t index, const settings& conf,
+    const std::string& uri, stompconn::send frame)
+{
+    auto& lane = lanes_[index];
+    std::lock_guard<std::mutex> g(lane.mutex);
+
+    auto lane_conf = conf.lane();
+    if (!lane.conn)
+    {
+        lane.conn = &get(lane_conf);
+
+        capst_journal.trace([&]{
+            std::string text;
+            text.reserve(64);
+            text += "pool: "sv;
+            text += name_;
+            text += " affinity lane:"sv;
+            text += std::to_string(index);
+            text += " open"sv;
+            return text;
+        });
+    }
+
+    auto& conn = *lane.conn;
+    try
+    {
+        // соединение остается за дорожкой и после ошибки
+        // следующий фрейм ключа переподключит его
+        conn.init(lane_conf);
+        conn.connect(btpro::uri(uri));
+        auto rc = conn.send_content(std::move(frame));
+
+        // дорожка не возвращается в пул и не дождется квитанций окна
+        // вызов успешен только с подтверждением
+        conn.wait_receipts(0);
+
+        // простой дорожки отсчитывает монитор
+        conn.set_idle(cluster::clock::now());
+
         return rc;
     }
+    catch (...)
+    {
+        conn.close();
+        throw;
+    }
+}
+
+void pool::monitor_lanes(cluster::clock::time_point now) noexcept
+{
+    auto idle_timeout = std::chrono::seconds(conf::idle_timeout());
+
+    std::size_t dead = 0;
+    std::size_t reaped = 0;
+    for (auto& lane : lanes_)
+    {
+        // занятая отправкой дорожка и так жива
+        std::unique_lock<std::mutex> g(lane.mutex, std::try_to_lock);
+        if (!g.owns_lock() || !lane.conn || !lane.conn->good())
+            continue;
+
+        auto& c = *lane.conn;
+        if (!c.heartbeat(now))
+            ++dead;
+        else if (now - c.idle_time() > idle_timeout)
+            ++reaped;
+        else
+            continue;
 
-    // иначе :)
-    // формируем список коммитов проходя по очереди до первого не готовго
-    // смотрим сколько было в ожидании
-    auto e = transaction_store_.end();
-    // пока не достигли конца списка
+        // соединение остается за дорожкой, следующий фрейм переподключит
+        c.close();
+    }
 
-    // прокручиваем лист
-    while (i->ready() && (i != e))
+    if (dead || reaped)
     {
+        capst_journal.cout([&]{
+            std::string text;
+            text.reserve(64);
+            text += "pool: "sv;
+            text += name_;
+            text += " close lanes dead: "sv;
+            text += std::to_string(dead);
+            text += " idle: "sv;
+            text += std::to_string(reaped);
+            return text;
+        });
+    }
+}
+
+pool::transaction_id_type pool::create_transaction(connection_id_type connection_id,
+    bool ordered)
+{
+    lock l(mutex_);
+    // создаем транзакцию
+    auto id = transactions_.create(connection_id, ordered);
+    if (!id)
+    {
+        throw std::runtime_error("pool: transaction ring is full, size=" +
+            std::to_string(transaction_ring_size));
+    }
+    return id;
+}
+
+// подтверждаем свою операцию и возвращаем номера для коммита
+transaction_range pool::get_uncommited(transaction_id_type i)
+{
+    lock l(mutex_);
+
+#ifdef CAPSTOMP_TRACE_LOG
         capst_journal.trace([&]{
             std::string text;
             text.reserve(64);
             text += "pool: "sv;
             text += name_;
             text += " transaction:"sv;
-            text += i->id();
-            text += " add commit"sv;
+            text += std::to_string(i);
+            text += " ready"sv;
             return text;
         });
+#endif
 
-        ++i;
-    }
+    // в любом случае наша транзакция выполнена
+    // забираем ее и готовые, если их не ждет более ранняя того же ключа
+    auto head = transactions_.head();
+    auto depth = transactions_.size();
+    commit_depth_.add(depth);
+    auto rc = transactions_.ready(i);
+    if (!rc.size())
+    {
+        // если наша транзакция не первая
+        // коммитить ее будет другой поток
+        capst_journal.cout([&]{
+            std::string text;
+            text.reserve(64);
+            text += "pool: "sv;
+            text += name_;
+            text += " transaction:"sv;
+            text += std::to_string(i);
+            text += " deffered commit, waiting: "sv;
+            text += std::to_string(depth);
+            text += " after transaction:"sv;
+            text += std::to_string(head);
+            return text;
+        });
 
-    // формируем список транзакций для отправки коммитов
-    rc.splice(rc.begin(), transaction_store_, b, i);
+        return rc;
+    }
 
     capst_journal.trace([&]{
         std::string text;
         text.reserve(64);
         text += "pool: "sv;
         text += name_;
+        text += " commit transactions:"sv;
+        text += std::to_string(rc.size());
+        text += " from "sv;
+        text += std::to_string(rc.ids.front());
         text += " transaction store size="sv;
-        text += std::to_string(transaction_store_.size());
+        text += std::to_string(transactions_.size());
         return text;
     });
 
-    // и возвращаем его
+    // сколько отложенные ждали своей очереди
+    auto now = transaction_ring_type::clock::now();
+    for (auto n : rc.ids)
+    {
+        auto& t = transactions_.at(n);
+        if (t.owner.load(std::memory_order_relaxed) != rc.owner)
+            continue;
+
+        using std::chrono::duration_cast;
+        using std::chrono::milliseconds;
+        commit_wait_.add(static_cast<std::uint64_t>(
+            duration_cast<milliseconds>(now - t.ready_time).count()));
+    }
+
     return rc;
 }
 
+void pool::expire_stuck(cluster::clock::time_point now) noexcept
+{
+    using std::chrono::duration_cast;
+    using std::chrono::milliseconds;
+
+    auto stuck = conf::stuck_timeout();
+    if (!stuck)
+        return;
+
+    // под мутексом только забираем, коммиты идут по сети без него
+    std::vector<std::pair<transaction_id_type, connection*>> list;
+    try
+    {
+        lock l(mutex_);
+
+        auto head = transactions_.head();
+        if (!head)
+            return;
+
+        // голова не готова, иначе ее бы уже забрали
+        auto age = duration_cast<milliseconds>(now - transactions_.at(head).time);
+        if (age < milliseconds(stuck))
+            return;
+
+        transactions_.expire(head);
+        ++expire_count_;
+
+        auto rc = transactions_.collect(head);
+
+        capst_journal.cerr([&]{
+            std::string text;
+            text.reserve(64);
+            text += "pool: "sv;
+            text += name_;
+            text += " transaction:"sv;
+            text += std::to_string(head);
+            text += " stuck for "sv;
+            text += std::to_string(age.count());
+            text += "ms, commit waiting: "sv;
+            text += std::to_string(rc.size());
+            return text;
+        });
+
+        list.reserve(rc.size());
+        for (auto i : rc.ids)
+        {
+            // сама зависшая закоммитится из своего потока
+            auto conn = (i != head) ? transactions_.member(rc.owner, i) : nullptr;
+            if (conn)
+                list.emplace_back(i, conn);
+        }
+    }
+    catch (...)
+    {   }
+
+    if (list.empty())
+        return;
+
+    auto commit = [this](const decltype(list)& chain) noexcept {
+        for (auto [i, conn] : chain)
+        {
+            try
+            {
+                // срок потока транзакции давно истек
+                conn->start_deadline();
+                conn->force_commit();
+            }
+            catch (...)
+            {
+                conn->close();
+            }
+
+            conn->end_transaction();
+            transactions_.done(i);
+            release_connection(conn);
+        }
+    };
+
+    // коммиты ждут квитанций, монитор обходит пулы без задержек
+    // пул не освободится, пока соединения цепочки не вернутся
+    try
+    {
+        connector::inst().post([commit, list]{
+            commit(list);
+        });
+    }
+    catch (...)
+    {
+        commit(list);
+    }
+}
+
 std::size_t pool::force_commit()
 {
     std::size_t rc = 0;
 
     lock l(mutex_);
 
-    auto i = transaction_store_.begin();
-    while (i != transaction_store_.end())
-    {
-        if (i->ready())
+    transactions_.each([&](transaction_id_type i) {
+        auto& s = transactions_.at(i);
+        auto conn = s.conn.load(std::memory_order_acquire);
+        // завершена без коммита
+        if (!conn)
+            return;
+
+        if (s.ready.load(std::memory_order_acquire))
         {
-            auto &conn = *i->connection();
-            conn.force_commit();
+            // снимаем с очереди и коммитим вне порядка
+            transactions_.expire(i);
+            conn->force_commit();
             // возможно это уничтожит этот объект
             // дальше им пользоваться уже нельзя
-            release_connection(i->connection());
-
-            i = transaction_store_.erase(i);
+            conn->end_transaction();
+            transactions_.done(i);
+            release_connection(conn);
 
             ++rc;
         }
@@ -328,18 +998,16 @@ std::size_t pool::force_commit()
                 text += "pool: "sv;
                 text += name_;
                 text += " force_commit transaction:"sv;
-                text += i->id();
+                text += conn->transaction_id();
                 text += " - not ready";
 #ifdef CAPSTOMP_STATE_DEBUG
                 text += ", state: "sv;
-                text += std::to_string(i->connection()->state());
+                text += std::to_string(conn->state());
 #endif
                 return text;
             });
-
-            ++i;
         }
-    }
+    });
 
     return rc;
 }
@@ -348,37 +1016,69 @@ std::string pool::json()
 {
     std::string rc;
 
-    lock l(mutex_);
-
+    // статус читает атомарные поля соединений
+    // выдачу и возврат соединений не блокирует
     rc += "{"sv;
         rc += "\"name\":\""sv; rc += name_; rc += "\""sv; rc += ',';
-        rc += "\"ready\":"sv; rc += json_arr(ready_); rc += ',';
-        rc += "\"active\":"sv; rc += json_arr(active_);
+        rc += "\"retain\":"sv;
+        rc += std::to_string(retain_.load()); rc += ',';
+        rc += "\"ready\":"sv;
+        rc += json_arr(connection::slot_ready); rc += ',';
+        rc += "\"active\":"sv;
+        rc += json_arr(connection::slot_active);
+        if (cluster_.size())
+        {
+            rc += ',';
+            rc += "\"nodes\":"sv; rc += cluster_.json();
+        }
+
+        rc += ',';
+        rc += "\"breaker\":"sv; rc += breaker_.json();
+        rc += ',';
+        rc += "\"commit_wait\":"sv; rc += commit_wait_.json();
+        rc += ',';
+        rc += "\"commit_depth\":"sv; rc += commit_depth_.json();
+        rc += ',';
+        rc += "\"expired\":"sv; rc += std::to_string(expire_count_.load());
+
+        lock l(mutex_);
+        if (sender_)
+        {
+            rc += ',';
+            rc += "\"async\":"sv; rc += sender_->json();
+        }
     rc += "}"sv;
 
     return rc;
 }
 
-std::string pool::json_arr(list_type& list)
+std::string pool::json_arr(int slot)
 {
     std::string rc;
     std::string tmp;
     tmp.reserve(2048);
     rc += '[';
-    for (auto& c: list)
+    auto size = slab_.size();
+    for (std::size_t i = 0; i < size; ++i)
     {
+        auto& c = slab_[i];
+        if (c.slot() != slot)
+            continue;
+
         if (!tmp.empty())
             tmp += ',';
 
         tmp += '{';
         tmp += "\"socket\":"sv;
-        tmp += std::to_string(c.socket().fd());
+        tmp += std::to_string(c.fd());
 #ifdef CAPSTOMP_STATE_DEBUG
         tmp += ",\"state\":"sv;
         tmp += std::to_string(c.state());
 #endif
         tmp += ",\"total_count\":"sv;
         tmp += std::to_string(c.total_count());
+        if (c.park_state() != connection::unparked)
+            tmp += ",\"parked\":true"sv;
         tmp += '}';
     }
     rc += tmp;
@@ -3,8 +3,22 @@
 #include "settings.hpp"
 #include "connection.hpp"
 #include "transaction.hpp"
+#include "sender.hpp"
+#include "slab.hpp"
+#include "cluster.hpp"
+#include "breaker.hpp"
+#include "histogram.hpp"
+#include "conf.hpp"
 
-#include <list>
+#include <array>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <functional>
+#include <string_view>
+#include <vector>
+#include <cstdint>
 #include <condition_variable>
 
 namespace capst {
@@ -12,52 +26,230 @@ namespace capst {
 class pool
 {
 public:
-    using list_type = connection::list_type;
     using connection_id_type = connection::connection_id_type;
 
 private:
+    // создание соединений и транзакции
+    // выдача и возврат соединений мутекс не используют
     std::mutex mutex_{};
     using lock = std::lock_guard<std::mutex>;
 
-    list_type active_{};
-    list_type ready_{};
+    // узлы брокера, переживают соединения хранилища
+    cluster cluster_{};
+    // автомат защиты от недоступного брокера
+    breaker breaker_{};
+
+    using slab_type = slab<connection>;
+    using stack_type = slab_stack<connection>;
+
+    slab_type slab_{};
+    // готовые к работе соединения с сокетом
+    stack_type ready_{slab_};
+    // закрытые соединения для повторного использования
+    stack_type free_{slab_};
+    // число выданных соединений
+    std::atomic<std::size_t> active_count_{};
+    // закрытые монитором, но еще лежащие в стеке готовых
+    std::atomic<std::size_t> stale_{};
+    // пик выданных между проходами монитора
+    std::atomic<std::size_t> peak_{};
+    // сглаженный пик, только поток монитора
+    double peak_ewma_{};
+    // сколько готовых соединений стоит держать
+    std::atomic<std::size_t> retain_{};
 
     // имя пула
     std::string name_{};
-    // номер последовательности транзакции в пуле
-    std::size_t transaction_seq_{};
 
-    using transaction_store_type = connection::transaction_store_type;
+    // уникальный номер пула для слотов потоков
+    // адрес пула может быть переиспользован
+    const std::uint64_t id_{};
+    // меняется при отзыве закрепленных соединений
+    std::atomic<std::size_t> epoch_{};
     using transaction_id_type = connection::transaction_id_type;
-    transaction_store_type transaction_store_{};
+    // слот держит соединение от create_transaction до done
+    // done всегда раньше возврата соединения в пул
+    // поэтому занятых слотов не больше выданных соединений
+    static constexpr std::size_t transaction_ring_size =
+        conf::max_pool_sockets_limit();
+    using transaction_ring_type =
+        transaction_ring<connection_id_type, transaction_ring_size>;
+    transaction_ring_type transactions_{};
+    // ожидание готовой транзакции до коммита, мс
+    histogram commit_wait_{};
+    // транзакций в кольце на момент готовности
+    histogram commit_depth_{};
+    // снятые с очереди монитором
+    std::atomic<std::size_t> expire_count_{};
+
+    // дорожка affinity, соединение закреплено за ключами навсегда
+    // фреймы одного ключа идут по одному сокету по очереди
+    struct lane
+    {
+        std::mutex mutex{};
+        connection_id_type conn{};
+    };
+    // не меньше предела capstomp_affinity_lanes
+    static constexpr std::size_t lane_max = 64u;
+    std::array<lane, lane_max> lanes_{};
+
+    // число готовых соединений, которое держит монитор
+    std::atomic<std::size_t> min_idle_{};
+    // адрес для подключения из фона, под мутексом
+    std::string idle_uri_{};
+    // поток прогрева, пока он работает пул не удаляется
+    std::thread warmup_{};
+    std::atomic<bool> warming_{};
 
-    std::string create_transaction_id();
+    // очередь асинхронной отправки, создается по требованию
+    // уничтожается первой, поток отправки использует пул
+    std::unique_ptr<sender> sender_{};
 
     void destroy();
 
     void release_connection(connection_id_type connection_id);
 
+    // вернуть соединения закрепленные за потоками
+    // вызывается под мутексом
+    void revoke() noexcept;
+
+    // новое или свободное соединение
+    connection& create_connection(std::size_t max_pool_sockets);
+
+    // забрать готовое соединение у монитора
+    static void take_ready(connection& conn, int to) noexcept;
+
+    // дополнить готовые соединения до min_idle в фоне
+    void fill_idle(std::size_t count);
+
+    // heart-beat дорожек affinity и закрытие простаивающих
+    void monitor_lanes(cluster::clock::time_point now) noexcept;
+
+    // снять с очереди транзакцию старше capstomp_stuck_timeout
+    // и закоммитить готовые, которые ее ждали
+    void expire_stuck(cluster::clock::time_point now) noexcept;
+
+    void update_peak(std::size_t active) noexcept
+    {
+        auto peak = peak_.load(std::memory_order_relaxed);
+        while ((active > peak) && !peak_.compare_exchange_weak(peak, active,
+            std::memory_order_relaxed))
+        {   }
+    }
+
+    // живые соединения в стеке готовых
+    std::size_t idle_size() const noexcept
+    {
+        auto ready = ready_.size();
+        auto stale = stale_.load(std::memory_order_relaxed);
+        return (ready > stale) ? ready - stale : 0;
+    }
+
 public:
     pool();
 
     pool(const std::string& name);
 
+    ~pool();
+
     void clear() noexcept;
 
-    std::size_t active_size()
+    // соединения, выполняющие запросы, erase их дожидается
+    std::size_t active_size() noexcept
     {
-        lock l(mutex_);
-        return active_.size();
+        std::size_t rc = warming_.load() ? 1 : 0;
+        auto size = slab_.size();
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            auto& c = slab_[i];
+            if ((c.slot() == connection::slot_active) &&
+                (c.park_state() == connection::unparked))
+            {
+                ++rc;
+            }
+        }
+        return rc;
+    }
+
+    // все выданные соединения, включая слоты потоков
+    // пул освобождается только когда их не осталось
+    std::size_t held_size() noexcept
+    {
+        std::size_t rc = warming_.load() ? 1 : 0;
+        auto size = slab_.size();
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            if (slab_[i].slot() == connection::slot_active)
+                ++rc;
+        }
+        return rc;
     }
 
     connection& get(const settings& conf);
 
     void release(connection_id_type connection_id);
 
-    transaction_id_type create_transaction(connection_id_type connection_id);
+    // вернуть соединение из слота потока
+    void release_parked(connection_id_type connection_id) noexcept;
 
-    // подтверждаем свою операцию и возвращаем список коммитов
-    transaction_store_type get_uncommited(transaction_id_type transaction_id);
+    sender& async(const std::string& uri);
+
+    // дорожка ключа, число дорожек задает capstomp_affinity_lanes
+    std::size_t lane_index(std::string_view key) const noexcept
+    {
+        auto size = std::min(conf::affinity_lanes(), lane_max);
+        return std::hash<std::string_view>()(key) % size;
+    }
+
+    // отправка фрейма через соединение дорожки
+    std::size_t send_affinity(std::size_t index, const settings& conf,
+        const std::string& uri, stompconn::send frame);
+
+    // открыть и залогинить count соединений параллельно
+    // возвращает число подключенных
+    std::size_t warmup(const std::string& uri, std::size_t count);
+
+    // запомнить цель по готовым соединениям для монитора
+    void keep_idle(std::size_t count, const std::string& uri);
+
+    // обслуживание простаивающих соединений из потока монитора
+    void monitor(cluster::clock::time_point now) noexcept;
+
+    cluster& nodes() noexcept
+    {
+        return cluster_;
+    }
+
+    breaker& circuit() noexcept
+    {
+        return breaker_;
+    }
+
+    // ordered - порядок коммитов внутри ключа order_by
+    transaction_id_type create_transaction(connection_id_type connection_id,
+        bool ordered);
+
+    // ключ упорядочивания транзакции
+    void order_transaction(transaction_id_type id, std::string_view key) noexcept
+    {
+        transactions_.order(id, std::hash<std::string_view>()(key));
+    }
+
+    // подтверждаем свою операцию и возвращаем номера для коммита
+    transaction_range get_uncommited(transaction_id_type transaction_id);
+
+    // соединение транзакции из выданного диапазона
+    // пустое если номер забран другим коммитом
+    connection_id_type transaction_connection(const transaction_range& range,
+        transaction_id_type id) const noexcept
+    {
+        return transactions_.member(range.owner, id);
+    }
+
+    const std::string& name() const noexcept
+    {
+        return name_;
+    }
 
     std::size_t force_commit();
 
@@ -65,7 +257,7 @@ public:
 
 private:
 
-    std::string json_arr(list_type& list);
+    std::string json_arr(int slot);
 };
 
 } // namespace capst
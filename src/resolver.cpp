@@ -0,0 +1,203 @@
+#include "resolver.hpp"
+#include "journal.hpp"
+#include "conf.hpp"
+
+#include "btpro/socket.hpp"
+
+#include <netdb.h>
+#include <cstring>
+#include <algorithm>
+
+using namespace std::literals;
+
+namespace capst {
+
+// сколько живет отрицательная запись, секунд
+constexpr auto negative_ttl = std::size_t{5u};
+
+resolver::list_type resolver::lookup(const std::string& host,
+    const std::string& port)
+{
+    capst_journal.trace([&]{
+        std::string text;
+        text.reserve(64);
+        text += "resolver: lookup "sv;
+        text += host, text += ':', text += port;
+        return text;
+    });
+
+    addrinfo *result = nullptr;
+    addrinfo hints{0, AF_UNSPEC, SOCK_STREAM, 0, 0, nullptr, nullptr, nullptr};
+    auto rc = getaddrinfo(host.c_str(), port.c_str(), &hints, &result);
+    if (0 != rc)
+    {
+        std::string msg{"getaddrinfo: "sv};
+        msg += std::to_string(rc);
+        msg += ' ';
+        msg += host;
+
+        if (rc == EAI_SYSTEM)
+            throw std::system_error(btpro::net::error_code(), msg);
+
+        std::string text(gai_strerror(rc));
+        text += ' '; text += msg;
+        throw std::runtime_error(text);
+    }
+
+    using holder_type = std::unique_ptr<addrinfo, void(*)(addrinfo*)>;
+    holder_type a(result, [](addrinfo* ptr){
+        freeaddrinfo(ptr);
+    });
+
+    // первое семейство как вернул getaddrinfo, остальные по очереди
+    list_type first;
+    list_type second;
+    for (auto i = result; i; i = i->ai_next)
+    {
+        if (i->ai_addrlen > sizeof(sockaddr_storage))
+            continue;
+
+        address addr;
+        std::memcpy(&addr.addr, i->ai_addr, i->ai_addrlen);
+        addr.size = static_cast<socklen_t>(i->ai_addrlen);
+
+        if (first.empty() || (first.front().family() == addr.family()))
+            first.push_back(addr);
+        else
+            second.push_back(addr);
+    }
+
+    list_type rc_list;
+    rc_list.reserve(first.size() + second.size());
+    for (std::size_t i = 0; i < std::max(first.size(), second.size()); ++i)
+    {
+        if (i < first.size())
+            rc_list.push_back(first[i]);
+        if (i < second.size())
+            rc_list.push_back(second[i]);
+    }
+
+    if (rc_list.empty())
+    {
+        std::string text{"unable to connect getaddrinfo: "sv};
+        text += host;
+        throw std::runtime_error(text);
+    }
+
+    return rc_list;
+}
+
+resolver::list_ptr resolver::resolve(const std::string& host,
+    const std::string& port, int timeout)
+{
+    auto key = host + ':' + port;
+
+    lock l(mutex_);
+
+    auto& e = cache_[key];
+    if (clock::now() < e.expire)
+    {
+        if (e.list)
+            return e.list;
+
+        throw std::runtime_error(e.error);
+    }
+
+    if (e.pending)
+    {
+        // устаревшие адреса лучше ожидания
+        if (e.list)
+            return e.list;
+
+        cv_.wait_for(l, std::chrono::milliseconds(timeout), [&]{
+            return !e.pending;
+        });
+
+        if (e.list)
+            return e.list;
+
+        if (!e.pending)
+            throw std::runtime_error(e.error);
+
+        throw std::runtime_error("resolve timeout: " + key);
+    }
+
+    e.pending = true;
+
+    l.unlock();
+
+    list_type list;
+    std::string error;
+    try
+    {
+        list = lookup(host, port);
+    }
+    catch (const std::exception& x)
+    {
+        error = x.what();
+    }
+    catch (...)
+    {
+        error = "resolve error: " + key;
+    }
+
+    l.lock();
+
+    e.pending = false;
+    cv_.notify_all();
+
+    auto ttl = conf::dns_ttl();
+    if (!list.empty())
+    {
+        e.list = std::make_shared<const list_type>(std::move(list));
+        e.error.clear();
+        e.expire = clock::now() + std::chrono::seconds(ttl);
+
+        capst_journal.trace([&]{
+            std::string text;
+            text.reserve(64);
+            text += "resolver: "sv;
+            text += key;
+            text += " addresses: "sv;
+            text += std::to_string(e.list->size());
+            return text;
+        });
+
+        return e.list;
+    }
+
+    // повторим попытку не раньше чем через negative_ttl
+    e.expire = clock::now() + std::chrono::seconds(std::min(ttl, negative_ttl));
+
+    capst_journal.cerr([&]{
+        std::string text;
+        text.reserve(64);
+        text += "resolver: "sv;
+        text += error;
+        if (e.list)
+            text += ", use stale addresses"sv;
+        return text;
+    });
+
+    if (e.list)
+        return e.list;
+
+    e.error = error;
+    throw std::runtime_error(error);
+}
+
+void resolver::clear() noexcept
+{
+    lock l(mutex_);
+
+    for (auto& i : cache_)
+        i.second.expire = clock::time_point();
+}
+
+resolver& resolver::inst() noexcept
+{
+    static resolver i;
+    return i;
+}
+
+} // namespace capst
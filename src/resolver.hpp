@@ -0,0 +1,74 @@
+#pragma once
+
+#include <sys/socket.h>
+
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <condition_variable>
+
+namespace capst {
+
+// кеш адресов брокеров, общий для всех пулов
+// имя резолвит один поток, остальные ждут его результат
+// при ошибке используются устаревшие адреса, если они есть
+class resolver
+{
+public:
+    struct address
+    {
+        sockaddr_storage addr{};
+        socklen_t size{};
+
+        int family() const noexcept
+        {
+            return addr.ss_family;
+        }
+
+        const sockaddr* sa() const noexcept
+        {
+            return reinterpret_cast<const sockaddr*>(&addr);
+        }
+    };
+
+    using list_type = std::vector<address>;
+    using list_ptr = std::shared_ptr<const list_type>;
+
+private:
+    using clock = std::chrono::steady_clock;
+    using lock = std::unique_lock<std::mutex>;
+
+    struct entry
+    {
+        list_ptr list{};
+        // ошибка для отрицательной записи
+        std::string error{};
+        clock::time_point expire{};
+        bool pending{};
+    };
+
+    std::mutex mutex_{};
+    std::condition_variable cv_{};
+    // записи не удаляются, на них ссылаются ждущие потоки
+    std::unordered_map<std::string, entry> cache_{};
+
+    resolver() = default;
+
+    // getaddrinfo, семейства адресов чередуются
+    static list_type lookup(const std::string& host, const std::string& port);
+
+public:
+    // бросает исключение если адресов нет
+    list_ptr resolve(const std::string& host,
+        const std::string& port, int timeout);
+
+    // все записи устаревают
+    void clear() noexcept;
+
+    static resolver& inst() noexcept;
+};
+
+} // namespace capst
@@ -0,0 +1,223 @@
+#include "sender.hpp"
+#include "pool.hpp"
+#include "conf.hpp"
+#include "journal.hpp"
+
+#include <algorithm>
+#include <sys/uio.h>
+
+using namespace std::literals;
+
+namespace capst {
+
+sender::sender(pool& pool, std::size_t capacity)
+    : pool_(pool)
+    , ring_(capacity)
+{
+    thread_ = std::thread([this]{
+        run();
+    });
+}
+
+sender::~sender()
+{
+    {
+        lock l(mutex_);
+        stop_ = true;
+    }
+
+    cv_.notify_one();
+
+    if (thread_.joinable())
+        thread_.join();
+}
+
+void sender::set_uri(const std::string& uri)
+{
+    lock l(mutex_);
+    if (uri_ != uri)
+        uri_ = uri;
+}
+
+bool sender::push(std::string data, std::size_t count)
+{
+    {
+        lock l(mutex_);
+
+        auto capacity = ring_.size();
+        if (size_ == capacity)
+        {
+            drop_count_ += count;
+            return false;
+        }
+
+        auto& i = ring_[(head_ + size_) % capacity];
+        i.data = std::move(data);
+        i.time = clock::now();
+        i.count = count;
+
+        // будим поток отправки только на первом фрейме
+        if (size_++)
+            return true;
+    }
+
+    cv_.notify_one();
+
+    return true;
+}
+
+void sender::run() noexcept
+{
+    std::string uri;
+    std::vector<item> batch;
+    batch.reserve(ring_.size());
+
+    lock l(mutex_);
+    while (true)
+    {
+        cv_.wait(l, [&]{
+            return stop_ || (size_ > 0);
+        });
+
+        auto stop = stop_;
+
+        // забираем все накопленные фреймы разом
+        auto capacity = ring_.size();
+        for (; size_ > 0; --size_)
+        {
+            batch.push_back(std::move(ring_[head_]));
+            head_ = (head_ + 1) % capacity;
+        }
+
+        uri = uri_;
+
+        l.unlock();
+
+        auto ok = batch.empty() || flush(uri, batch);
+        batch.clear();
+
+        l.lock();
+
+        if (stop)
+            break;
+
+        // брокер недоступен, не крутимся вхолостую
+        // фреймы копятся в очереди пока она не переполнится
+        if (!ok)
+        {
+            auto pause = std::chrono::milliseconds(
+                std::min(conf::timeout(), std::size_t{1000u}));
+            cv_.wait_for(l, pause, [&]{
+                return stop_;
+            });
+        }
+    }
+}
+
+std::size_t sender::frame_count(const std::vector<item>& batch) noexcept
+{
+    std::size_t rc = 0;
+    for (auto& i : batch)
+        rc += i.count;
+    return rc;
+}
+
+bool sender::flush(const std::string& uri, std::vector<item>& batch)
+{
+    connection* conn = nullptr;
+
+    try
+    {
+        btpro::uri u(uri);
+
+        conn = &pool_.get(settings::create(u));
+        conn->connect(u);
+
+        // одна отправка на всю пачку фреймов
+        std::vector<iovec> iov;
+        iov.reserve(batch.size());
+        for (auto& i : batch)
+            iov.push_back({ i.data.data(), i.data.size() });
+
+        conn->send_batch(iov.data(), iov.size(), frame_count(batch));
+
+        // возвращаем соединение в пул
+        conn->commit();
+
+        auto lag = clock::now() - batch.front().time;
+
+        lock l(mutex_);
+        total_count_ += frame_count(batch);
+        lag_ = lag;
+        max_lag_ = std::max(max_lag_, lag);
+
+        return true;
+    }
+    catch (const std::exception& e)
+    {
+        capst_journal.cerr([&]{
+            std::string text;
+            text.reserve(64);
+            text += "sender: drop "sv;
+            text += std::to_string(frame_count(batch));
+            text += " frames - "sv;
+            text += e.what();
+            return text;
+        });
+    }
+    catch (...)
+    {
+        capst_journal.cerr([&]{
+            std::string text;
+            text.reserve(64);
+            text += "sender: drop "sv;
+            text += std::to_string(frame_count(batch));
+            text += " frames"sv;
+            return text;
+        });
+    }
+
+    if (conn)
+    {
+        try
+        {
+            // закрытое соединение пул не сохранит
+            conn->close();
+            conn->commit();
+        }
+        catch (...)
+        {   }
+    }
+
+    lock l(mutex_);
+    error_count_ += frame_count(batch);
+
+    return false;
+}
+
+std::string sender::json()
+{
+    using std::chrono::duration_cast;
+    using std::chrono::milliseconds;
+
+    std::string rc;
+    rc.reserve(160);
+
+    lock l(mutex_);
+
+    rc += '{';
+        rc += "\"capacity\":"sv; rc += std::to_string(ring_.size());
+        rc += ",\"depth\":"sv; rc += std::to_string(size_);
+        rc += ",\"drop\":"sv; rc += std::to_string(drop_count_);
+        rc += ",\"error\":"sv; rc += std::to_string(error_count_);
+        rc += ",\"total_count\":"sv; rc += std::to_string(total_count_);
+        rc += ",\"lag\":"sv;
+        rc += std::to_string(duration_cast<milliseconds>(lag_).count());
+        rc += ",\"max_lag\":"sv;
+        rc += std::to_string(duration_cast<milliseconds>(max_lag_).count());
+    rc += '}';
+
+    return rc;
+}
+
+} // namespace capst
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+namespace capst {
+
+class pool;
+// очередь асинхронной отправки пула
+// udf только копирует фрейм в кольцевой буфер
+// отправкой брокеру занимается отдельный поток
+class sender
+{
+    using clock = std::chrono::steady_clock;
+    using lock = std::unique_lock<std::mutex>;
+
+    struct item
+    {
+        std::string data{};
+        clock::time_point time{};
+        // фреймов в элементе, пачка занимает один элемент
+        std::size_t count{};
+    };
+
+    pool& pool_;
+
+    std::mutex mutex_{};
+    std::condition_variable cv_{};
+
+    // кольцевой буфер фиксированного размера
+    std::vector<item> ring_{};
+    std::size_t head_{};
+    std::size_t size_{};
+
+    // адрес брокера для потока отправки
+    std::string uri_{};
+
+    // статистика очереди
+    std::size_t drop_count_{};
+    std::size_t error_count_{};
+    std::size_t total_count_{};
+    clock::duration lag_{};
+    clock::duration max_lag_{};
+
+    bool stop_{};
+    std::thread thread_{};
+
+    void run() noexcept;
+
+    static std::size_t frame_count(const std::vector<item>& batch) noexcept;
+
+    bool flush(const std::string& uri, std::vector<item>& batch);
+
+public:
+    sender(pool& pool, std::size_t capacity);
+
+    ~sender();
+
+    void set_uri(const std::string& uri);
+
+    // false если очередь переполнена и фрейм отброшен
+    bool push(std::string data, std::size_t count = 1);
+
+    std::string json();
+};
+
+} // namespace capst
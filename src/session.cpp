@@ -0,0 +1,397 @@
+#include "session.hpp"
+#include "store.hpp"
+#include "journal.hpp"
+#include "mysql.hpp"
+#include "conf.hpp"
+
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <cstring>
+
+using namespace std::literals;
+
+namespace capst {
+
+// открытые транзакции по CONNECTION_ID(), их обходит монитор
+static std::mutex registry_mutex;
+static std::unordered_map<std::uint64_t, session::binding_ptr> registry;
+
+static std::chrono::seconds session_timeout() noexcept
+{
+    return std::chrono::seconds(conf::session_timeout());
+}
+
+static bool expired(const session::binding& b,
+    session::clock::time_point now) noexcept
+{
+    return now - b.start > session_timeout();
+}
+
+bool session::own(binding& b) noexcept
+{
+    int users = 0;
+    return b.users.compare_exchange_strong(users, -1,
+        std::memory_order_acquire, std::memory_order_relaxed);
+}
+
+void session::abort(binding& b, std::string_view reason) noexcept
+{
+    capst_journal.cerr([&]{
+        std::string text;
+        text.reserve(64);
+        text += "session: abort transaction:"sv;
+        text += b.conn->transaction_id();
+        text += " - "sv;
+        text += reason;
+        return text;
+    });
+
+    try
+    {
+        b.conn->end_session(false);
+    }
+    catch (const std::exception& e)
+    {
+        capst_journal.cerr([&]{
+            std::string text;
+            text.reserve(64);
+            text += "session: "sv;
+            text += e.what();
+            return text;
+        });
+    }
+    catch (...)
+    {   }
+}
+
+session::binding_ptr session::find(const btpro::uri& u, std::string_view hosts,
+    std::uint64_t id)
+{
+    // без номера сессии вызов идет мимо транзакции
+    if (!id)
+        return binding_ptr();
+
+    // буфер имени переиспользуется потоком mysql
+    thread_local std::string name;
+    store::name(u, hosts, name);
+
+    binding_ptr stale;
+    {
+        std::lock_guard<std::mutex> l(registry_mutex);
+        auto i = registry.find(id);
+        if (i == registry.end())
+            return binding_ptr();
+
+        auto b = i->second;
+        // монитор уже прервал транзакцию
+        if (b->users.load(std::memory_order_acquire) < 0)
+        {
+            registry.erase(i);
+            return binding_ptr();
+        }
+
+        if (!expired(*b, clock::now()))
+        {
+            if (name != b->name)
+                return binding_ptr();
+
+            // монитор мог перехватить привязку
+            auto& users = b->users;
+            auto n = users.load(std::memory_order_relaxed);
+            while (n >= 0)
+            {
+                if (users.compare_exchange_weak(n, n + 1,
+                    std::memory_order_acquire, std::memory_order_relaxed))
+                {
+                    return b;
+                }
+            }
+            return binding_ptr();
+        }
+
+        if (!own(*b))
+            return binding_ptr();
+
+        stale = std::move(b);
+        registry.erase(i);
+    }
+
+    // ABORT по сети без мутекса
+    abort(*stale, "timeout"sv);
+    return binding_ptr();
+}
+
+void session::begin(const std::string& uri, std::uint64_t id)
+{
+    if (!id)
+        throw std::runtime_error("capstomp_begin: CONNECTION_ID() required");
+
+    // брошенная транзакция прошлого запроса сессии
+    binding_ptr prev;
+    {
+        std::lock_guard<std::mutex> l(registry_mutex);
+        auto i = registry.find(id);
+        if (i != registry.end())
+        {
+            auto& b = *i->second;
+            if (own(b))
+                prev = i->second;
+            else if (b.users.load(std::memory_order_acquire) >= 0)
+                throw std::runtime_error("session transaction in use");
+            registry.erase(i);
+        }
+    }
+
+    if (prev)
+        abort(*prev, "unfinished"sv);
+
+    std::string hosts;
+    auto norm = cluster::normalize(uri, hosts);
+    btpro::uri u(norm);
+
+    auto& conn = store::inst().get(u, hosts, norm);
+    try
+    {
+        conn.init(settings::create_session(u, id));
+        conn.begin_session(u);
+    }
+    catch (...)
+    {
+        conn.close();
+        conn.release();
+        throw;
+    }
+
+    auto b = std::make_shared<binding>();
+    b->conn = &conn;
+    store::name(u, hosts, b->name);
+    b->start = clock::now();
+    b->id = id;
+
+    std::lock_guard<std::mutex> l(registry_mutex);
+    registry[id] = std::move(b);
+}
+
+bool session::end(bool commit, std::uint64_t id)
+{
+    binding_ptr b;
+    {
+        std::lock_guard<std::mutex> l(registry_mutex);
+        auto i = registry.find(id);
+        if (i == registry.end())
+            return false;
+
+        // монитор уже прервал транзакцию
+        if (i->second->users.load(std::memory_order_acquire) < 0)
+        {
+            registry.erase(i);
+            return false;
+        }
+
+        // привязка остается за сессией, пока ее вызовы не завершены
+        if (!own(*i->second))
+            throw std::runtime_error("session transaction in use");
+
+        b = std::move(i->second);
+        registry.erase(i);
+    }
+
+    if (expired(*b, clock::now()))
+    {
+        abort(*b, "timeout"sv);
+        return false;
+    }
+
+    capst_journal.trace([&]{
+        std::string text;
+        text.reserve(64);
+        text += "session: "sv;
+        text += commit ? "commit"sv : "abort"sv;
+        text += " transaction:"sv;
+        text += b->conn->transaction_id();
+        return text;
+    });
+
+    b->conn->end_session(commit);
+
+    return true;
+}
+
+void session::expire(clock::time_point now) noexcept
+{
+    std::vector<binding_ptr> stale;
+
+    try
+    {
+        std::lock_guard<std::mutex> l(registry_mutex);
+
+        auto i = registry.begin();
+        while (i != registry.end())
+        {
+            auto& b = *i->second;
+            // завершенные убираем, просроченные и не занятые забираем
+            auto done = b.users.load(std::memory_order_acquire) < 0;
+            if (done || (expired(b, now) && own(b)))
+            {
+                if (!done)
+                    stale.push_back(std::move(i->second));
+                i = registry.erase(i);
+            }
+            else
+                ++i;
+        }
+    }
+    catch (...)
+    {   }
+
+    // соединение возвращается в пул
+    for (auto& b : stale)
+        abort(*b, "timeout"sv);
+}
+
+} // namespace capst
+
+// CONNECTION_ID() в init может быть еще не вычислен
+// поэтому работа выполняется в основной функции
+static std::uint64_t capstomp_thread_id(UDF_ARGS* args, unsigned int i) noexcept
+{
+    if ((i < args->arg_count) && args->args[i])
+    {
+        return static_cast<std::uint64_t>(
+            *reinterpret_cast<long long*>(args->args[i]));
+    }
+    return 0;
+}
+
+//                    0       1
+// "capstomp_begin(\"uri\", CONNECTION_ID())"
+extern "C" my_bool capstomp_begin_init(UDF_INIT* initid,
+    UDF_ARGS* args, char* msg)
+{
+    auto args_count = args->arg_count;
+    if ((args_count != 2) || (args->arg_type[0] != STRING_RESULT) ||
+        (args->arg_type[1] != INT_RESULT))
+    {
+        strncpy(msg, "bad args, use capstomp_begin(\"uri\", CONNECTION_ID())",
+            MYSQL_ERRMSG_SIZE);
+        return 1;
+    }
+
+    initid->maybe_null = 0;
+    initid->const_item = 0;
+
+    return my_bool();
+}
+
+extern "C" long long capstomp_begin(UDF_INIT*,
+    UDF_ARGS* args, char* is_null, char* error)
+{
+    *is_null = 0;
+
+    try
+    {
+        if (!args->args[0] || !args->lengths[0])
+            throw std::runtime_error("capstomp_begin: empty uri");
+
+        capst::session::begin(
+            std::string(args->args[0], args->lengths[0]),
+            capstomp_thread_id(args, 1));
+
+        return 1;
+    }
+    catch (const std::exception& e)
+    {
+        capst_journal.cerr([&]{
+            return std::string(e.what());
+        });
+    }
+    catch (...)
+    {
+        capst_journal.cerr([&]{
+            return ":*(";
+        });
+    }
+
+    *error = 1;
+    return 0;
+}
+
+extern "C" void capstomp_begin_deinit(UDF_INIT*)
+{   }
+
+my_bool capstomp_end_init(bool commit, UDF_INIT* initid,
+    UDF_ARGS* args, char* msg)
+{
+    if ((args->arg_count != 1) || (args->arg_type[0] != INT_RESULT))
+    {
+        strncpy(msg, commit ? "bad args, use capstomp_commit(CONNECTION_ID())" :
+            "bad args, use capstomp_rollback(CONNECTION_ID())",
+            MYSQL_ERRMSG_SIZE);
+        return 1;
+    }
+
+    initid->maybe_null = 0;
+    initid->const_item = 0;
+
+    return my_bool();
+}
+
+// 1 если транзакция сессии завершена, 0 если ее не было
+long long capstomp_end(bool commit, UDF_ARGS* args,
+    char* is_null, char* error)
+{
+    *is_null = 0;
+
+    try
+    {
+        auto rc = capst::session::end(commit,
+            capstomp_thread_id(args, 0));
+        return rc ? 1 : 0;
+    }
+    catch (const std::exception& e)
+    {
+        capst_journal.cerr([&]{
+            return std::string(e.what());
+        });
+    }
+    catch (...)
+    {
+        capst_journal.cerr([&]{
+            return ":*(";
+        });
+    }
+
+    *error = 1;
+    return 0;
+}
+
+extern "C" my_bool capstomp_commit_init(UDF_INIT* initid,
+    UDF_ARGS* args, char* msg)
+{
+    return capstomp_end_init(true, initid, args, msg);
+}
+
+extern "C" long long capstomp_commit(UDF_INIT*,
+    UDF_ARGS* args, char* is_null, char* error)
+{
+    return capstomp_end(true, args, is_null, error);
+}
+
+extern "C" void capstomp_commit_deinit(UDF_INIT*)
+{   }
+
+extern "C" my_bool capstomp_rollback_init(UDF_INIT* initid,
+    UDF_ARGS* args, char* msg)
+{
+    return capstomp_end_init(false, initid, args, msg);
+}
+
+extern "C" long long capstomp_rollback(UDF_INIT*,
+    UDF_ARGS* args, char* is_null, char* error)
+{
+    return capstomp_end(false, args, is_null, error);
+}
+
+extern "C" void capstomp_rollback_deinit(UDF_INIT*)
+{   }
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "btpro/uri.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <string_view>
+
+namespace capst {
+
+class connection;
+
+// STOMP транзакция сессии mysql
+// capstomp_begin закрепляет соединение с транзакцией за CONNECTION_ID()
+// вызовы capstomp того же пула с session=<CONNECTION_ID()> в uri
+// до capstomp_commit идут через него
+// поток mysql переходит к другой сессии без уведомления udf,
+// поэтому привязка ищется по номеру сессии, а не по потоку
+// и живет не дольше capstomp_session_timeout
+class session
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    // транзакция, закрепленная за сессией
+    struct binding
+    {
+        connection* conn{};
+        // имя пула транзакции
+        std::string name{};
+        clock::time_point start{};
+        // CONNECTION_ID() из capstomp_begin
+        std::uint64_t id{};
+        // вызовы на соединении, -1 - транзакция завершается
+        // завершает тот, кто перевел счетчик из 0 в -1
+        std::atomic<int> users{};
+    };
+
+    using binding_ptr = std::shared_ptr<binding>;
+
+private:
+    // захватить привязку для завершения
+    static bool own(binding& b) noexcept;
+
+    // ABORT без исключений, соединение уходит в пул
+    static void abort(binding& b, std::string_view reason) noexcept;
+
+public:
+    // привязка сессии id, если вызов идет в ее пул
+    // вызов занимает соединение до leave
+    static binding_ptr find(const btpro::uri& u, std::string_view hosts,
+        std::uint64_t id);
+
+    static void leave(const binding_ptr& b) noexcept
+    {
+        b->users.fetch_sub(1, std::memory_order_release);
+    }
+
+    static void begin(const std::string& uri, std::uint64_t id);
+
+    // false если у сессии id нет транзакции
+    static bool end(bool commit, std::uint64_t id);
+
+    // прерывание просроченных транзакций из монитора
+    static void expire(clock::time_point now) noexcept;
+};
+
+} // namespace capst
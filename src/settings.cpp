@@ -18,6 +18,12 @@ bool read_bool(const char *value) noexcept
     return std::atoi(value) > 0;
 }
 
+std::size_t read_size(const char *value) noexcept
+{
+    auto rc = std::atoll(value);
+    return (rc > 0) ? static_cast<std::size_t>(rc) : std::size_t();
+}
+
 void settings::parse(std::string_view query)
 {
     if (!query.empty())
@@ -31,6 +37,16 @@ void settings::parse(std::string_view query)
             constexpr auto with_transaction = "transaction"sv;
             constexpr auto with_no_error = "no_error"sv;
             constexpr auto with_skip_error = "skip_error"sv;
+            constexpr auto with_async = "async"sv;
+            constexpr auto with_cork = "cork"sv;
+            constexpr auto with_thread_cache = "thread_cache"sv;
+            constexpr auto with_replay = "replay"sv;
+            constexpr auto with_pipeline = "pipeline"sv;
+            constexpr auto with_min_idle = "min_idle"sv;
+            constexpr auto with_deadline_ms = "deadline_ms"sv;
+            constexpr auto with_order_by = "order_by"sv;
+            constexpr auto with_affinity = "affinity"sv;
+            constexpr auto with_session = "session"sv;
             for (auto h = hdr.tqh_first; h; h = h->next.tqe_next)
             {
                 auto key = h->key;
@@ -108,7 +124,126 @@ void settings::parse(std::string_view query)
                         });
 
                         no_error_ = no_error;
-                    }  
+                    }
+                    else if (with_async == key)
+                    {
+                        auto async = read_bool(val);
+                        capst_journal.trace([=]{
+                            std::string text;
+                            text += "set async = "sv;
+                            text += std::to_string(async);
+                            return text;
+                        });
+
+                        async_ = async;
+                    }
+                    else if (with_cork == key)
+                    {
+                        auto cork = read_bool(val);
+                        capst_journal.trace([=]{
+                            std::string text;
+                            text += "set cork = "sv;
+                            text += std::to_string(cork);
+                            return text;
+                        });
+
+                        cork_ = cork;
+                    }
+                    else if (with_thread_cache == key)
+                    {
+                        auto thread_cache = read_bool(val);
+                        capst_journal.trace([=]{
+                            std::string text;
+                            text += "set thread_cache = "sv;
+                            text += std::to_string(thread_cache);
+                            return text;
+                        });
+
+                        thread_cache_ = thread_cache;
+                    }
+                    else if (with_replay == key)
+                    {
+                        auto replay = read_bool(val);
+                        capst_journal.trace([=]{
+                            std::string text;
+                            text += "set replay = "sv;
+                            text += std::to_string(replay);
+                            return text;
+                        });
+
+                        replay_ = replay;
+                    }
+                    else if (with_pipeline == key)
+                    {
+                        auto pipeline = read_bool(val);
+                        capst_journal.trace([=]{
+                            std::string text;
+                            text += "set pipeline = "sv;
+                            text += std::to_string(pipeline);
+                            return text;
+                        });
+
+                        pipeline_ = pipeline;
+                    }
+                    else if (with_min_idle == key)
+                    {
+                        auto min_idle = read_size(val);
+                        capst_journal.trace([=]{
+                            std::string text;
+                            text += "set min_idle = "sv;
+                            text += std::to_string(min_idle);
+                            return text;
+                        });
+
+                        min_idle_ = min_idle;
+                    }
+                    else if (with_deadline_ms == key)
+                    {
+                        auto deadline_ms = read_size(val);
+                        capst_journal.trace([=]{
+                            std::string text;
+                            text += "set deadline_ms = "sv;
+                            text += std::to_string(deadline_ms);
+                            return text;
+                        });
+
+                        deadline_ms_ = deadline_ms;
+                    }
+                    else if (with_order_by == key)
+                    {
+                        capst_journal.trace([=]{
+                            std::string text;
+                            text += "set order_by = "sv;
+                            text += val;
+                            return text;
+                        });
+
+                        order_by_ = val;
+                    }
+                    else if (with_affinity == key)
+                    {
+                        capst_journal.trace([=]{
+                            std::string text;
+                            text += "set affinity = "sv;
+                            text += val;
+                            return text;
+                        });
+
+                        affinity_ = val;
+                    }
+                    else if (with_session == key)
+                    {
+                        auto session = static_cast<std::uint64_t>(
+                            std::strtoull(val, nullptr, 10));
+                        capst_journal.trace([=]{
+                            std::string text;
+                            text += "set session = "sv;
+                            text += std::to_string(session);
+                            return text;
+                        });
+
+                        session_ = session;
+                    }
                 }
             }
             evhttp_clear_headers(&hdr);
@@ -120,6 +255,59 @@ settings settings::create(const btpro::uri& u)
 {
     settings s;
     s.parse(u.query());
+
+    // порядок по ключу дает дорожка, транзакции и очередь не нужны
+    if (!s.affinity_.empty())
+    {
+        s.transaction_ = false;
+        s.async_ = false;
+        s.thread_cache_ = false;
+    }
+
+    // асинхронная отправка выполняется без транзакций
+    if (s.async_)
+        s.transaction_ = false;
+
+    // повтор возможен только вне транзакции и очереди пула
+    if (s.transaction_ || s.async_)
+        s.replay_ = false;
+
+    // порядок по ключу имеет смысл только для транзакций
+    if (!s.transaction_)
+        s.order_by_.clear();
+
+    return s;
+}
+
+settings settings::create_session(const btpro::uri& u, std::uint64_t id)
+{
+    auto s = create(u);
+    s.session_ = id;
+    s.transaction_ = false;
+    s.async_ = false;
+    s.thread_cache_ = false;
+    s.replay_ = false;
+    s.order_by_.clear();
+    s.affinity_.clear();
+    return s;
+}
+
+settings settings::lane() const
+{
+    // дорожка не коммитится, копить фреймы до конца запроса нельзя
+    auto s = *this;
+    s.affinity_.clear();
+    s.cork_ = false;
+    return s;
+}
+
+settings settings::create_idle(const btpro::uri& u)
+{
+    auto s = create(u);
+    s.transaction_ = false;
+    s.receipt_ = false;
+    s.thread_cache_ = false;
+    s.affinity_.clear();
     return s;
 }
 
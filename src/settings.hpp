@@ -2,6 +2,8 @@
 
 #include "btpro/uri.hpp"
 
+#include <cstdint>
+
 namespace capst {
 
 class settings
@@ -19,6 +21,36 @@ protected:
     // always return ok
     bool no_error_{ false };
 
+    // fire-and-forget publish through the pool queue
+    bool async_{ false };
+
+    // coalesce frames of a statement into few writes
+    bool cork_{ false };
+
+    // keep one connection per mysql thread
+    bool thread_cache_{ false };
+
+    // resend unconfirmed frames after reconnect
+    bool replay_{ false };
+
+    // write CONNECT without waiting for CONNECTED on a deferred connect
+    bool pipeline_{ false };
+
+    // idle connections kept open by the monitor
+    std::size_t min_idle_{};
+
+    // budget of one udf call in ms, 0 - only per operation timeout
+    std::size_t deadline_ms_{};
+
+    // commit order key: routing_key or header name, empty - pool-wide
+    std::string order_by_{};
+
+    // lane key: routing_key or header name, empty - no affinity
+    std::string affinity_{};
+
+    // CONNECTION_ID() of a capstomp_begin transaction, 0 - none
+    std::uint64_t session_{};
+
     void parse(std::string_view query);
 
 public:
@@ -26,6 +58,15 @@ public:
 
     static settings create(const btpro::uri& u);
 
+    // подключение заранее, без транзакции и квитанций
+    static settings create_idle(const btpro::uri& u);
+
+    // транзакцию сессии ведет сама сессия, не пул
+    static settings create_session(const btpro::uri& u, std::uint64_t id);
+
+    // настройки соединения дорожки affinity
+    settings lane() const;
+
     bool receipt() const noexcept
     {
         return receipt_;
@@ -50,6 +91,56 @@ public:
     {
         return no_error_;
     }
+
+    bool async() const noexcept
+    {
+        return async_;
+    }
+
+    bool cork() const noexcept
+    {
+        return cork_;
+    }
+
+    bool thread_cache() const noexcept
+    {
+        return thread_cache_;
+    }
+
+    bool replay() const noexcept
+    {
+        return replay_;
+    }
+
+    bool pipeline() const noexcept
+    {
+        return pipeline_;
+    }
+
+    std::size_t min_idle() const noexcept
+    {
+        return min_idle_;
+    }
+
+    std::size_t deadline_ms() const noexcept
+    {
+        return deadline_ms_;
+    }
+
+    const std::string& order_by() const noexcept
+    {
+        return order_by_;
+    }
+
+    const std::string& affinity() const noexcept
+    {
+        return affinity_;
+    }
+
+    std::uint64_t session() const noexcept
+    {
+        return session_;
+    }
 };
 
 } // namespace capst
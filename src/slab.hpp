@@ -0,0 +1,151 @@
+#pragma once
+
+#include <new>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <stdexcept>
+
+namespace capst {
+
+// хранилище объектов пула блоками
+// объекты не перемещаются и живут до уничтожения хранилища
+// номер объекта постоянный, читать можно без блокировок
+// добавление выполняется только под мутексом владельца
+template<class T, std::size_t C = 16, std::size_t N = 512>
+class slab
+{
+    struct chunk
+    {
+        alignas(T) unsigned char data[C][sizeof(T)];
+    };
+
+    std::array<std::atomic<chunk*>, N> chunk_{};
+    std::atomic<std::size_t> size_{};
+
+    T* at(std::size_t i) const noexcept
+    {
+        auto c = chunk_[i / C].load(std::memory_order_acquire);
+        return reinterpret_cast<T*>(c->data[i % C]);
+    }
+
+public:
+    slab() = default;
+
+    slab(const slab&) = delete;
+    slab& operator=(const slab&) = delete;
+
+    ~slab()
+    {
+        auto size = size_.load();
+        for (std::size_t i = 0; i < size; ++i)
+            at(i)->~T();
+
+        for (auto& c : chunk_)
+            delete c.load();
+    }
+
+    static constexpr std::size_t capacity() noexcept
+    {
+        return C * N;
+    }
+
+    // количество созданных объектов
+    std::size_t size() const noexcept
+    {
+        return size_.load(std::memory_order_acquire);
+    }
+
+    T& operator[](std::size_t i) const noexcept
+    {
+        return *at(i);
+    }
+
+    // создать объект, возвращает его номер
+    template<class... A>
+    std::size_t emplace(A&&... args)
+    {
+        auto i = size_.load(std::memory_order_relaxed);
+        if (i >= capacity())
+            throw std::runtime_error("slab: capacity=" +
+                                     std::to_string(capacity()));
+
+        auto& c = chunk_[i / C];
+        if (!c.load(std::memory_order_relaxed))
+            c.store(new chunk, std::memory_order_release);
+
+        new (c.load(std::memory_order_relaxed)->data[i % C])
+            T(std::forward<A>(args)..., i);
+
+        // объект виден читателям только после конструирования
+        size_.store(i + 1, std::memory_order_release);
+
+        return i;
+    }
+};
+
+// lock-free стек номеров объектов хранилища
+// ссылка на следующий элемент хранится в самом объекте
+// объекты не освобождаются, поэтому читать ссылку безопасно
+// счетчик в старшей половине головы защищает от ABA
+template<class T>
+class slab_stack
+{
+    slab<T>& slab_;
+    // номер + 1 в младшей половине, 0 - стек пуст
+    std::atomic<std::uint64_t> head_{};
+    std::atomic<std::size_t> size_{};
+
+    static constexpr std::uint64_t make(std::uint64_t head,
+        std::uint32_t next) noexcept
+    {
+        return (((head >> 32) + 1) << 32) | next;
+    }
+
+public:
+    explicit slab_stack(slab<T>& slab) noexcept
+        : slab_(slab)
+    {   }
+
+    // размер приблизительный, только для лимитов и статуса
+    std::size_t size() const noexcept
+    {
+        return size_.load(std::memory_order_relaxed);
+    }
+
+    void push(std::size_t i) noexcept
+    {
+        // счетчик увеличиваем до публикации, чтобы pop не ушел в минус
+        size_.fetch_add(1, std::memory_order_relaxed);
+
+        auto& node = slab_[i];
+        auto head = head_.load(std::memory_order_relaxed);
+        std::uint64_t next;
+        do {
+            node.set_next(static_cast<std::uint32_t>(head));
+            next = make(head, static_cast<std::uint32_t>(i + 1));
+        } while (!head_.compare_exchange_weak(head, next,
+            std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    T* pop() noexcept
+    {
+        auto head = head_.load(std::memory_order_acquire);
+        while (auto top = static_cast<std::uint32_t>(head))
+        {
+            auto& node = slab_[top - 1];
+            auto next = make(head, node.next());
+            if (head_.compare_exchange_weak(head, next,
+                std::memory_order_acquire, std::memory_order_acquire))
+            {
+                size_.fetch_sub(1, std::memory_order_relaxed);
+                return &node;
+            }
+        }
+        return nullptr;
+    }
+};
+
+} // namespace capst
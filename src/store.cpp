@@ -3,55 +3,104 @@
 #include "journal.hpp"
 #include "mysql.hpp"
 #include "conf.hpp"
+#include "resolver.hpp"
+#include "monitor.hpp"
+
+#include <charconv>
 
 using namespace std::literals;
 
 namespace capst {
 
-std::string endpoint(const btpro::uri& uri)
+// имя пула: login@host:port/path#fragment
+// смена пароля приведет к формированию нового пула
+void endpoint(const btpro::uri& uri, std::string_view hosts, std::string& t)
 {
-    // смена пароля приведет к формированию нового пула
     auto [l, _p] = uri.auth();
-    auto a = uri.addr_port(61613);
+    auto h = uri.host();
     auto p = uri.path();
     auto f = uri.fragment();
 
-    std::string t;
-    t.reserve(l.size() + a.size() + p.size() + f.size() + 2);
+    char port[8];
+    auto [port_end, ec] = std::to_chars(port, port + sizeof(port),
+        uri.port(61613));
 
+    t.clear();
     t += l;
     t += '@';
-    t += a;
+    if (hosts.empty())
+    {
+        t += h;
+        t += ':';
+        t.append(port, port_end);
+    }
+    else
+        t += hosts;
     t += p;
     t += '#';
     t += f;
-    return t;
 }
 
-pool& store::select_pool(const btpro::uri& u)
+// пока поток читает список шарда, узлы шарда не освобождаются
+// читатель учитывается в счетчике эпохи, в которую вошел
+class reader
 {
-    auto name = endpoint(u);
-    auto pool_max = conf::max_pool_count();
+    std::atomic<std::size_t>& readers_;
 
-    lock l(mutex_);
+public:
+    reader(const std::atomic<std::uint64_t>& epoch,
+        std::array<std::atomic<std::size_t>, 2>& readers) noexcept
+        : readers_(readers[epoch.load() & 1u])
+    {
+        readers_.fetch_add(1);
+    }
 
-    auto f = store_.find(name);
-    if (f != store_.end())
+    ~reader()
     {
-        capst_journal.trace([&]{
-            std::string text;
-            text += "store: use existing "sv;
-            text += f->second.json();
-            text += ", size="sv;
-            text += std::to_string(store_.size());
-            return text;
-        });
+        readers_.fetch_sub(1);
+    }
+};
 
-        return f->second;
+store::~store()
+{
+    for (auto& s : shard_)
+    {
+        auto n = s.head.load();
+        while (n)
+        {
+            auto next = n->next.load();
+            delete n;
+            n = next;
+        }
     }
+}
+
+store::node* store::find(shard& s, std::size_t hash,
+    std::string_view name) noexcept
+{
+    for (auto n = s.head.load(); n; n = n->next.load())
+    {
+        if ((n->hash == hash) && (n->name == name))
+            return n;
+    }
+
+    return nullptr;
+}
+
+pool& store::select_pool(shard& s, std::size_t hash, const std::string& name)
+{
+    auto pool_max = conf::max_pool_count();
+
+    lock l(s.mutex);
+
+    // пул мог создать другой поток
+    auto f = find(s, hash, name);
+    if (f)
+        return f->value;
 
     // проверяем доступно ли создание нового пула
-    if (store_.size() > pool_max)
+    auto size = size_.load();
+    if (size > pool_max)
     {
         throw std::runtime_error("store: max pool count =" +
                                  std::to_string(pool_max));
@@ -61,46 +110,194 @@ pool& store::select_pool(const btpro::uri& u)
         std::string text;
         text.reserve(64);
         text += "store: create pool, size="sv;
-        text += std::to_string(store_.size());
+        text += std::to_string(size);
         text += ", max="sv;
         text += std::to_string(pool_max);
         return text;
     });
 
-    return store_[name];
+    auto n = std::make_unique<node>(hash, name);
+    n->next.store(s.head.load());
+    // публикуем узел для читателей
+    s.head.store(n.get());
+    ++size_;
+
+    return n.release()->value;
 }
 
-connection& store::get(const btpro::uri& u)
+void store::unlink(shard& s, node* n) noexcept
 {
+    // сам узел не меняем
+    // по нему еще могут идти читатели
+    auto link = &s.head;
+    for (auto i = link->load(); i; i = link->load())
+    {
+        if (i == n)
+        {
+            link->store(n->next.load());
+            return;
+        }
+
+        link = &i->next;
+    }
+}
+
+void store::advance(shard& s) noexcept
+{
+    // счетчик прошлой эпохи перейдет следующей
+    auto e = s.epoch.load();
+    if (s.readers[(e + 1) & 1u].load() == 0)
+        s.epoch.store(e + 1);
+}
+
+void store::reclaim() noexcept
+{
+    try
+    {
+        lock l(retired_mutex_);
+
+        if (retired_.empty())
+            return;
+
+        // читатели входят коротко, под постоянной нагрузкой
+        // счетчик прошлой эпохи все равно опустеет
+        for (auto& s : shard_)
+        {
+            advance(s);
+            advance(s);
+        }
+
+        auto i = retired_.begin();
+        while (i != retired_.end())
+        {
+            // узел уже недоступен новым читателям
+            // ждем старых и завершения работы соединений пула
+            if ((i->owner->epoch.load() >= i->epoch + 2) &&
+                (i->ptr->value.held_size() == 0))
+            {
+                capst_journal.cout([&]{
+                    std::string text;
+                    text.reserve(64);
+                    text += "store: destroy pool "sv;
+                    text += i->ptr->name;
+                    return text;
+                });
+
+                i = retired_.erase(i);
+            }
+            else
+                ++i;
+        }
+    }
+    catch (...)
+    {   }
+}
+
+pool& store::select_pool(std::string_view hosts,
+    std::size_t hash, const std::string& name)
+{
+    auto& s = select_shard(hash);
+
     // выбираем пулл
-    auto& pool = select_pool(u);
+    auto f = find(s, hash, name);
+    if (f)
+    {
+        capst_journal.trace([&]{
+            std::string text;
+            text += "store: use existing "sv;
+            text += f->value.json();
+            text += ", size="sv;
+            text += std::to_string(size_.load());
+            return text;
+        });
+    }
+
+    auto& pool = f ? f->value : select_pool(s, hash, name);
+
+    if (!hosts.empty())
+        pool.nodes().assign(hosts, 61613);
+
+    return pool;
+}
+
+connection& store::get(const btpro::uri& u, std::string_view hosts,
+    const std::string& uri)
+{
+    // буфер имени переиспользуется потоком mysql
+    thread_local std::string name;
+    endpoint(u, hosts, name);
+
+    auto hash = std::hash<std::string>{}(name);
+    auto& s = select_shard(hash);
+
+    reader r(s.epoch, s.readers);
+
+    auto& pool = select_pool(hosts, hash, name);
+
+    auto conf = settings::create(u);
+
+    // готовые соединения держит монитор
+    auto min_idle = conf.min_idle();
+    pool.keep_idle(min_idle, uri);
+
+    // монитор также закрывает лишние готовые соединения
+    monitor::inst().start();
 
     // выбираем подключение
-    return pool.get(settings::create(u));
+    return pool.get(conf);
+}
+
+void store::name(const btpro::uri& u, std::string_view hosts,
+    std::string& name)
+{
+    endpoint(u, hosts, name);
+}
+
+std::size_t store::warmup(const std::string& uri, std::size_t count)
+{
+    std::string hosts;
+    auto norm = cluster::normalize(uri, hosts);
+    btpro::uri u(norm);
+
+    std::string name;
+    endpoint(u, hosts, name);
+
+    auto hash = std::hash<std::string>{}(name);
+    auto& s = select_shard(hash);
+
+    // пул не будет освобожден пока идет прогрев
+    reader r(s.epoch, s.readers);
+
+    return select_pool(hosts, hash, name).warmup(norm, count);
 }
 
 std::string store::json()
 {
+    reclaim();
+
     std::string rc;
     rc.reserve(256);
 
     bool first_line = true;
 
-    lock l(mutex_);
-
     rc += '[';
 
-    for(auto& i: store_)
+    for (auto& s : shard_)
     {
-        if (!first_line)
-            rc += ',';
+        reader r(s.epoch, s.readers);
+
+        for (auto n = s.head.load(); n; n = n->next.load())
+        {
+            if (!first_line)
+                rc += ',';
 
-        rc += '{';
-            rc += "\"name\":\""sv; rc += std::get<0>(i); rc += "\","sv;
-            rc += "\"pool\":"sv; rc += std::get<1>(i).json();
-        rc += '}';
+            rc += '{';
+                rc += "\"name\":\""sv; rc += n->name; rc += "\","sv;
+                rc += "\"pool\":"sv; rc += n->value.json();
+            rc += '}';
 
-        first_line = false;
+            first_line = false;
+        }
     }
 
     rc += ']';
@@ -110,29 +307,47 @@ std::string store::json()
 
 void store::erase(const std::string& name)
 {
-    lock l(mutex_);
+    auto hash = std::hash<std::string>{}(name);
+    auto& s = select_shard(hash);
+
+    {
+        lock l(s.mutex);
+
+        auto f = find(s, hash, name);
+        if (!f)
+            throw std::runtime_error("store erase: " + name + " - not found");
+
+        auto running = f->value.active_size();
+        if (running > 0)
+            throw std::runtime_error("store erase: " + name + " - has " +
+                                     std::to_string(running) + " running");
 
-    auto f = store_.find(name);
-    if (f == store_.end())
-        throw std::runtime_error("store erase: " + name + " - not found");
+        // закрепленные за потоками соединения закрываем
+        f->value.clear();
 
-    auto running = f->second.active_size();
-    if (running > 0)
-        throw std::runtime_error("store erase: " + name + " - has " +
-                                 std::to_string(running) + " running");
+        unlink(s, f);
+        --size_;
 
-    store_.erase(f);
+        lock r(retired_mutex_);
+        retired_.push_back(retired{&s, std::unique_ptr<node>(f),
+            s.epoch.load()});
+    }
+
+    reclaim();
 }
 
 std::size_t store::commit(const std::string& name)
 {
-    lock l(mutex_);
+    auto hash = std::hash<std::string>{}(name);
+    auto& s = select_shard(hash);
+
+    reader r(s.epoch, s.readers);
 
-    auto f = store_.find(name);
-    if (f == store_.end())
+    auto f = find(s, hash, name);
+    if (!f)
         throw std::runtime_error("store commit: " + name + " - not found");
 
-    auto count = f->second.force_commit();
+    auto count = f->value.force_commit();
 
     capst_journal.cout([count]{
         std::string text;
@@ -147,8 +362,40 @@ std::size_t store::commit(const std::string& name)
 
 void store::clear()
 {
-    lock l(mutex_);
-    store_.clear();
+    for (auto& s : shard_)
+    {
+        lock l(s.mutex);
+
+        // отцепляем весь список разом
+        auto n = s.head.exchange(nullptr);
+
+        lock r(retired_mutex_);
+        for (; n; n = n->next.load())
+        {
+            n->value.clear();
+            retired_.push_back(retired{&s, std::unique_ptr<node>(n),
+                s.epoch.load()});
+            --size_;
+        }
+    }
+
+    // пулы с работающими соединениями
+    // будут уничтожены позже
+    reclaim();
+
+    // адреса брокеров резолвим заново
+    resolver::inst().clear();
+}
+
+void store::each(const std::function<void(pool&)>& fn)
+{
+    for (auto& s : shard_)
+    {
+        reader r(s.epoch, s.readers);
+
+        for (auto n = s.head.load(); n; n = n->next.load())
+            fn(n->value);
+    }
 }
 
 store& store::inst() noexcept
@@ -203,6 +450,68 @@ extern "C" my_bool capstomp_store_commit_init(UDF_INIT* initid,
     return 1;
 }
 
+extern "C" my_bool capstomp_pool_warmup_init(UDF_INIT* initid,
+    UDF_ARGS* args, char* msg)
+{
+    try
+    {
+        auto args_count = args->arg_count;
+        if ((args_count != 2) ||
+            (!(args->arg_type[0] == STRING_RESULT)) || (args->lengths[0] == 0) ||
+            (!(args->arg_type[1] == INT_RESULT)) || !args->args[1])
+        {
+            strncpy(msg, "bad args, use capstomp_pool_warmup(\"uri\", count)",
+                MYSQL_ERRMSG_SIZE);
+            return 1;
+        }
+
+        auto count = *reinterpret_cast<long long*>(args->args[1]);
+        if (count < 0)
+            count = 0;
+
+        auto& store = capst::store::inst();
+        initid->ptr =
+            reinterpret_cast<char*>(static_cast<std::intptr_t>(
+                store.warmup(std::string(args->args[0], args->lengths[0]),
+                    static_cast<std::size_t>(count))));
+
+        initid->maybe_null = 0;
+        initid->const_item = 0;
+
+        return my_bool();
+    }
+    catch (const std::exception& e)
+    {
+        capst_journal.cerr([&]{
+            return std::string(e.what());
+        });
+        snprintf(msg, MYSQL_ERRMSG_SIZE, "%s", e.what());
+    }
+    catch (...)
+    {
+
+        strncpy(msg, ":*(", MYSQL_ERRMSG_SIZE);
+
+        capst_journal.cerr([&]{
+            return ":*(";
+        });
+    }
+
+    return 1;
+}
+
+extern "C" long long capstomp_pool_warmup(UDF_INIT* initid,
+    UDF_ARGS*, char* is_null, char*)
+{
+    *is_null = 0;
+
+    return static_cast<long long>(
+        reinterpret_cast<std::intptr_t>(initid->ptr));
+}
+
+extern "C" void capstomp_pool_warmup_deinit(UDF_INIT*)
+{   }
+
 extern "C" my_bool capstomp_store_erase_init(UDF_INIT* initid,
     UDF_ARGS* args, char* msg)
 {
@@ -3,27 +3,103 @@
 #include "pool.hpp"
 
 #include <list>
+#include <array>
 #include <mutex>
+#include <atomic>
+#include <memory>
 #include <string>
-#include <unordered_map>
+#include <cstdint>
+#include <functional>
 
 namespace capst {
 
+// хранилище пулов
+// поиск пула выполняется без блокировок
+// мутексы шардов берут только добавление и удаление
 class store
 {
-    using store_type = std::unordered_map<std::string, pool>;
     using lock = std::lock_guard<std::mutex>;
 
-    std::mutex mutex_{};
-    store_type store_{};
+    struct node
+    {
+        std::size_t hash{};
+        std::string name{};
+        pool value{};
+        std::atomic<node*> next{};
+
+        node(std::size_t h, std::string n)
+            : hash(h)
+            , name(std::move(n))
+        {   }
+    };
+
+    struct shard
+    {
+        // только для писателей
+        std::mutex mutex{};
+        std::atomic<node*> head{};
+        // эпоха шарда, двигает только reclaim
+        std::atomic<std::uint64_t> epoch{};
+        // читатели списка по четности эпохи входа
+        // новые читатели не задерживают освобождение старых узлов
+        std::array<std::atomic<std::size_t>, 2> readers{};
+    };
+
+    // удаленный из шарда узел ждет пока им перестанут пользоваться
+    struct retired
+    {
+        shard* owner{};
+        std::unique_ptr<node> ptr{};
+        // эпоха шарда после отцепления узла
+        std::uint64_t epoch{};
+    };
+
+    static constexpr std::size_t shard_count = 16u;
+
+    std::array<shard, shard_count> shard_{};
+    std::atomic<std::size_t> size_{};
+
+    std::mutex retired_mutex_{};
+    std::list<retired> retired_{};
 
     store() = default;
 
-    pool& select_pool(const btpro::uri& u);
+    ~store();
+
+    shard& select_shard(std::size_t hash) noexcept
+    {
+        return shard_[hash % shard_count];
+    }
+
+    static node* find(shard& s, std::size_t hash,
+        std::string_view name) noexcept;
+
+    pool& select_pool(shard& s, std::size_t hash, const std::string& name);
+
+    // найти или создать пул, вызывается внутри секции читателя
+    pool& select_pool(std::string_view hosts,
+        std::size_t hash, const std::string& name);
+
+    // отцепить узел от шарда, вызывается под мутексом шарда
+    void unlink(shard& s, node* n) noexcept;
+
+    // сменить эпоху, если вышли все читатели прошлой
+    // узел отцепленный в эпоху e свободен от читателей с эпохи e + 2
+    static void advance(shard& s) noexcept;
 
 public:
 
-    connection& get(const btpro::uri& u);
+    // hosts - список узлов кластера из uri, если их несколько
+    // uri - строка для подключений из фона
+    connection& get(const btpro::uri& u, std::string_view hosts,
+        const std::string& uri);
+
+    // имя пула для uri
+    static void name(const btpro::uri& u, std::string_view hosts,
+        std::string& name);
+
+    // открыть count соединений пула заранее
+    std::size_t warmup(const std::string& uri, std::size_t count);
 
     std::string json();
 
@@ -33,6 +109,13 @@ public:
 
     void clear();
 
+    // обход всех пулов для фонового обслуживания
+    void each(const std::function<void(pool&)>& fn);
+
+    // освободить узлы, которые больше никто не использует
+    // монитор вызывает после обхода, пулы освобождаются без erase и clear
+    void reclaim() noexcept;
+
     static store& inst() noexcept;
 };
 
@@ -1,61 +1,337 @@
 #pragma once
 
-#include "btdef/date.hpp"
-#include <string_view>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <cstdint>
 
 namespace capst {
 
-template<class T, class C>
-class transaction
+// транзакции забранные одним коммитом владельца owner
+struct transaction_range
 {
-    using string_type = T;
+    std::uint64_t owner{};
+    // номера в порядке очереди
+    std::vector<std::uint64_t> ids{};
+
+    std::size_t size() const noexcept
+    {
+        return ids.size();
+    }
+};
+
+// кольцо транзакций пула
+// слот занимает транзакция от create до done, свободный ищется по кругу
+// слотов не меньше выданных соединений, каждое держит не больше одного
+// номер транзакции растет, младшая часть номера - слот
+// ожидающие коммита стоят в очереди в порядке создания
+// коммиты одного ключа идут в порядке очереди
+// все кроме order, member и done вызывается под мутексом пула
+template<class C, std::size_t N>
+class transaction_ring
+{
+public:
     using connection_type = C;
-    using ready_type = std::size_t;
-    using date_type = btdef::date;
+    using id_type = std::uint64_t;
+    using partition_type = std::size_t;
+    using clock = std::chrono::steady_clock;
+
+    // ключ еще не известен, никого не ждет и не задерживает
+    static constexpr auto partition_none = partition_type{};
+    // упорядочена со всеми, без order_by или с разными ключами
+    static constexpr auto partition_all = ~partition_type{};
+
+    struct slot
+    {
+        // соединение с транзакцией, пустой слот свободен
+        std::atomic<connection_type> conn{};
+        std::atomic<id_type> id{};
+        std::atomic<partition_type> partition{};
+        std::atomic<bool> ready{};
+        // номер транзакции забравшей слот на коммит
+        // свой номер - транзакция снята с очереди монитором
+        std::atomic<id_type> owner{};
+        // начало и готовность, под мутексом пула
+        clock::time_point time{};
+        clock::time_point ready_time{};
+        // место в очереди, под мутексом пула
+        bool queued{};
+        std::size_t prev{};
+        std::size_t next{};
+    };
+
+private:
+    // конец очереди
+    static constexpr std::size_t npos = N;
+
+    std::array<slot, N> slot_{};
+    // ключи задерживающих транзакций при проходе collect
+    // открытая адресация, ячейка занята только в своем проходе
+    static constexpr std::size_t blocked_size = 2 * N;
+    std::array<partition_type, blocked_size> blocked_key_{};
+    std::array<std::uint64_t, blocked_size> blocked_pass_{};
+    std::uint64_t pass_{};
+    // очередь ожидающих коммита
+    std::size_t head_{npos};
+    std::size_t tail_{npos};
+    std::size_t size_{};
+    // с него начинается поиск свободного слота
+    std::size_t cursor_{};
+    id_type seq_{};
+
+    // ключей не больше N, свободная ячейка всегда найдется
+    // true если ключ уже был
+    bool block(partition_type p) noexcept
+    {
+        for (auto i = p % blocked_size; ; i = (i + 1) % blocked_size)
+        {
+            if (blocked_pass_[i] != pass_)
+            {
+                blocked_pass_[i] = pass_;
+                blocked_key_[i] = p;
+                return false;
+            }
+
+            if (blocked_key_[i] == p)
+                return true;
+        }
+    }
+
+    bool blocked(partition_type p) const noexcept
+    {
+        for (auto i = p % blocked_size; blocked_pass_[i] == pass_;
+             i = (i + 1) % blocked_size)
+        {
+            if (blocked_key_[i] == p)
+                return true;
+        }
+        return false;
+    }
+
+    void link(std::size_t i) noexcept
+    {
+        auto& s = slot_[i];
+        s.prev = tail_;
+        s.next = npos;
+        if (tail_ != npos)
+            slot_[tail_].next = i;
+        else
+            head_ = i;
+        tail_ = i;
+        s.queued = true;
+        ++size_;
+    }
+
+    void unlink(std::size_t i) noexcept
+    {
+        auto& s = slot_[i];
+        if (s.prev != npos)
+            slot_[s.prev].next = s.next;
+        else
+            head_ = s.next;
+        if (s.next != npos)
+            slot_[s.next].prev = s.prev;
+        else
+            tail_ = s.prev;
+        s.prev = s.next = npos;
+        s.queued = false;
+        --size_;
+    }
+
+    // убрать из очереди завершенные без коммита
+    // done вызывается без мутекса, слот остается в очереди до прохода
+    void purge() noexcept
+    {
+        for (auto i = head_; i != npos; )
+        {
+            auto next = slot_[i].next;
+            if (!slot_[i].conn.load(std::memory_order_acquire))
+                unlink(i);
+            i = next;
+        }
+    }
+
+    id_type find_free(connection_type conn, bool ordered) noexcept
+    {
+        for (std::size_t k = 0; k < N; ++k)
+        {
+            auto i = (cursor_ + k) % N;
+            auto& s = slot_[i];
+            // слот еще коммитится или ждет прохода purge
+            if (s.queued || s.conn.load(std::memory_order_acquire))
+                continue;
+
+            cursor_ = (i + 1) % N;
 
-    using data_type =
-        std::tuple<string_type, date_type, ready_type, connection_type>;
+            auto id = ++seq_ * N + i;
+            s.ready.store(false, std::memory_order_relaxed);
+            s.owner.store(0, std::memory_order_relaxed);
+            s.partition.store(ordered ? partition_none : partition_all,
+                std::memory_order_relaxed);
+            s.id.store(id, std::memory_order_relaxed);
+            s.time = clock::now();
+            s.conn.store(conn, std::memory_order_release);
+            link(i);
+            return id;
+        }
 
-    data_type that_{ string_type(),
-        date_type::now(), ready_type(), connection_type()};
+        return 0;
+    }
 
 public:
-    transaction() = default;
+    transaction_ring() = default;
+
+    slot& at(id_type id) noexcept
+    {
+        return slot_[id % N];
+    }
 
-    transaction(std::string_view id, connection_type connection) noexcept
-        : that_(id, date_type::now(), ready_type(), connection)
-    {   }
+    const slot& at(id_type id) const noexcept
+    {
+        return slot_[id % N];
+    }
+
+    // 0 если все слоты заняты
+    id_type create(connection_type conn, bool ordered) noexcept
+    {
+        auto id = find_free(conn, ordered);
+        if (!id)
+        {
+            purge();
+            id = find_free(conn, ordered);
+        }
+        return id;
+    }
+
+    // ключ пишет только поток транзакции
+    // второй другой ключ упорядочивает транзакцию со всеми
+    void order(id_type id, partition_type p) noexcept
+    {
+        if ((p == partition_none) || (p == partition_all))
+            p = 1;
+
+        auto& s = at(id).partition;
+        auto prev = s.load(std::memory_order_relaxed);
+        if (prev == partition_none)
+            s.store(p, std::memory_order_release);
+        else if (prev != p)
+            s.store(partition_all, std::memory_order_release);
+    }
+
+    // наша транзакция выполнена
+    // забираем все готовые, которых не ждет более ранняя того же ключа
+    transaction_range ready(id_type id)
+    {
+        auto& s = at(id);
+        s.ready_time = clock::now();
+        s.ready.store(true, std::memory_order_release);
+
+        // снятая с очереди коммитится сама, без порядка
+        if (s.owner.load(std::memory_order_relaxed) == id)
+            return { id, { id } };
+
+        return collect(id);
+    }
+
+    // забрать готовые транзакции на коммит владельцу owner
+    transaction_range collect(id_type owner)
+    {
+        transaction_range rc;
+        rc.owner = owner;
+
+        // один проход по очереди, ключ проверяется за O(1)
+        // первая задерживающая partition_all останавливает проход
+        ++pass_;
+        std::size_t blocked_count = 0;
+        for (auto i = head_; i != npos; )
+        {
+            auto& s = slot_[i];
+            auto next = s.next;
+
+            // завершена без коммита
+            if (!s.conn.load(std::memory_order_acquire))
+            {
+                unlink(i);
+                i = next;
+                continue;
+            }
+
+            auto p = s.partition.load(std::memory_order_acquire);
+            auto free = s.ready.load(std::memory_order_acquire);
+            if (free && blocked_count && (p != partition_none))
+                free = (p != partition_all) && !blocked(p);
+
+            if (free)
+            {
+                s.owner.store(owner, std::memory_order_relaxed);
+                rc.ids.push_back(s.id.load(std::memory_order_relaxed));
+                unlink(i);
+            }
+            else if (p == partition_all)
+                break;
+            else if ((p != partition_none) && !block(p))
+                ++blocked_count;
+
+            i = next;
+        }
+
+        return rc;
+    }
 
-    auto id() const noexcept
+    // снять транзакцию с очереди
+    // за ней больше никто не ждет, сама она закоммитится при готовности
+    void expire(id_type id) noexcept
     {
-        auto& i = std::get<string_type>(that_);
-        return std::string_view(i.data(), i.size());
+        auto& s = at(id);
+        s.owner.store(id, std::memory_order_relaxed);
+        if (s.queued)
+            unlink(id % N);
     }
 
-    auto time() const noexcept
+    // соединение транзакции i, если ее забрал коммит owner
+    connection_type member(id_type owner, id_type i) const noexcept
     {
-        return std::get<date_type>(that_);
+        auto& s = at(i);
+        if ((s.id.load(std::memory_order_acquire) != i) ||
+            (s.owner.load(std::memory_order_relaxed) != owner))
+        {
+            return connection_type();
+        }
+        return s.conn.load(std::memory_order_acquire);
     }
 
-    auto ready() const noexcept
+    // обход очереди, fn может снять транзакцию через expire
+    template<class F>
+    void each(F fn)
     {
-        return std::get<ready_type>(that_) > ready_type();
+        purge();
+        for (auto i = head_; i != npos; )
+        {
+            auto next = slot_[i].next;
+            fn(slot_[i].id.load(std::memory_order_relaxed));
+            i = next;
+        }
     }
 
-    auto connection() const noexcept
+    // коммит отправлен, слот можно занимать снова
+    void done(id_type id) noexcept
     {
-        return std::get<connection_type>(that_);
+        at(id).conn.store(connection_type(), std::memory_order_release);
     }
 
-    template<class V>
-    void set(V value)
+    // старейшая ожидающая коммита, 0 - очередь пуста
+    id_type head() noexcept
     {
-        std::get<V>(that_) = value;
+        purge();
+        return (head_ != npos) ?
+            slot_[head_].id.load(std::memory_order_relaxed) : 0;
     }
 
-    void set(bool ready) noexcept
+    // ожидающих коммита, с еще не убранными завершенными
+    std::size_t size() const noexcept
     {
-        set(static_cast<ready_type>(ready));
+        return size_;
     }
 };
 
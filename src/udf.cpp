@@ -1,7 +1,10 @@
 #include "store.hpp"
+#include "session.hpp"
+#include "frame.hpp"
 #include "journal.hpp"
 #include "mysql.hpp"
 #include <thread>
+#include <memory>
 #include <sys/types.h>
 
 #ifndef WIN32
@@ -59,88 +62,23 @@ struct version
 
 static const version capst_version_startup;
 
-//             0        1                2             3
-// "capstomp(\"uri\", \"routing-key\", \"json-data\"[, param])"
-// "capstomp(\"uri\", \"routing-key\", \"json-data\"[, param])"
-// "capstomp_json(\"uri\", \"routing-key\", \"json-data\"[, param])"
-// "capstomp_json(\"uri\", \"routing-key\", \"json-data\"[, param])"
-extern "C" my_bool capstomp_init(UDF_INIT* initid,
-    UDF_ARGS* args, char* msg)
+// состояние вызова udf
+struct capstomp_context
 {
-    capst::connection *conn = nullptr;
-
-    try
-    {
-        auto args_count = args->arg_count;
-        if ((args_count < 3) ||
-            (!((args->arg_type[0] == STRING_RESULT) &&
-               (args->arg_type[1] == STRING_RESULT) &&
-               (args->arg_type[2] == STRING_RESULT))))
-        {
-            strncpy(msg, "bad args type, use "
-                "capstomp(\"uri\", \"routing-key\", \"json-data\"[, param])",
-                MYSQL_ERRMSG_SIZE);
-            return 1;
-        }
-
-        std::string u(args->args[0], args->lengths[0]);
-        if (u.empty())
-        {
-            strncpy(msg, "empty uri, use "
-                "capstomp(\"uri\", \"routing-key\", \"json-data\"[, param])",
-                MYSQL_ERRMSG_SIZE);
-            return 1;
-        }
-
-        // парсим урл
-        btpro::uri uri(u);
-        // получаем хранилище
-        auto& store = capst::store::inst();
-
-        // получаем пулл соединенией
-        conn = &store.get(uri);
-
-        // сохраняем
-        initid->ptr = reinterpret_cast<char*>(conn);
-
-        // подключаемся либо повтороно используем соединение
-        conn->connect(uri);
-
-        initid->maybe_null = 0;
-        initid->const_item = 0;
-
-        return 0;
-    }
-    catch (const std::exception& e)
-    {
-        snprintf(msg, MYSQL_ERRMSG_SIZE, "%s", e.what());
-    }
-    catch (...)
-    {
-        strncpy(msg, ":*(", MYSQL_ERRMSG_SIZE);
-    }
-
-    if (conn)
-    {
-        // закроем сокет, чтобы пометить коннект как не удачный
-        conn->close();
-        
-        // но не бдуем его отдавать в пул
-        if (conn->with_no_error())
-            return 0;
-
-        // коммитим все зависящие от нас транзакции
-        // и возвращаем соединение в пулл
-        conn->commit();
-    }
-
-    capst_journal.cout([&]{
-        std::string text;
-        text += "capstomp_init: 1"sv;
-        return text;
-    });
-    return 1;
-}
+    capst::connection* conn{};
+    // заготовка фрейма, если аргументы постоянные
+    capst::frame frame{};
+    // накопленные фреймы агрегатной функции
+    std::string data{};
+    std::size_t count{};
+    // начало последнего фрейма в data, на него ставится квитанция
+    std::size_t last{};
+    // отправлено по дорожкам affinity
+    std::size_t sent{};
+    // транзакция сессии, коммит делает capstomp_commit
+    capst::session::binding_ptr session{};
+    bool error{};
+};
 
 template<class T>
 bool detect(std::string_view key) noexcept
@@ -151,8 +89,20 @@ bool detect(std::string_view key) noexcept
         : std::memcmp(text.data(), key.data(), text_size) == 0;
 }
 
-bool capstomp_fill_kv_header(stompconn::send& frame,
-                             const char *ptr, const char *end)
+void capstomp_push_header(stompconn::send& frame,
+                          std::string_view key, std::string_view val)
+{
+    frame.push(stompconn::header::make(key, val));
+}
+
+void capstomp_push_header(capst::frame& frame,
+                          std::string_view key, std::string_view val)
+{
+    frame.push(key, val);
+}
+
+template<class F>
+bool capstomp_fill_kv_header(F& frame, const char *ptr, const char *end)
 {
     bool custom_content_type = false;
     constexpr auto eq = "="sv;
@@ -179,7 +129,6 @@ bool capstomp_fill_kv_header(stompconn::send& frame,
             return custom_content_type;
         }
 
-        using namespace stompconn;
         using content_type = stompconn::header::tag::content_type;
         custom_content_type = detect<content_type>(key);
 
@@ -193,7 +142,7 @@ bool capstomp_fill_kv_header(stompconn::send& frame,
             return text;
         });
 
-        frame.push(header::make(key, val));
+        capstomp_push_header(frame, key, val);
     }
     else
     {
@@ -206,8 +155,8 @@ bool capstomp_fill_kv_header(stompconn::send& frame,
     return custom_content_type;
 }
 
-bool capstomp_split_kv_header(stompconn::send& frame,
-                              const char *ptr, const char *end)
+template<class F>
+bool capstomp_split_kv_header(F& frame, const char *ptr, const char *end)
 {
     bool custom_content_type = false;
     constexpr static std::string_view a = "&"sv;
@@ -227,8 +176,8 @@ bool capstomp_split_kv_header(stompconn::send& frame,
 // "capstomp(\"uri\", \"routing-key\", \"json-data\"[, param])"
 // "capstomp_json(\"uri\", \"routing-key\", \"json-data\"[, param])"
 // "capstomp_json(\"uri\", \"routing-key\", \"json-data\"[, param])"
-bool capstomp_fill_headers(stompconn::send& frame,
-                           UDF_ARGS* args, unsigned int from)
+template<class F>
+bool capstomp_fill_headers(F& frame, UDF_ARGS* args, unsigned int from)
 {
     bool custom_content_type = false;
     auto arg_count = args->arg_count;
@@ -264,6 +213,280 @@ bool capstomp_fill_headers(stompconn::send& frame,
     return custom_content_type;
 }
 
+std::string capstomp_destination(std::string_view base, UDF_ARGS* args)
+{
+    std::string destination(base);
+    std::string_view routing_key(args->args[1], args->lengths[1]);
+    if (!routing_key.empty())
+    {
+        destination += '/';
+        destination += routing_key;
+    }
+    return destination;
+}
+
+// ключ строки для order_by и affinity
+// routing_key или имя заголовка из параметров
+std::string_view capstomp_order_key(const std::string& order_by,
+                                    UDF_ARGS* args)
+{
+    if (order_by == "routing_key"sv)
+        return std::string_view(args->args[1], args->lengths[1]);
+
+    for (unsigned int i = 3; i < args->arg_count; ++i)
+    {
+        if ((args->arg_type[i] != STRING_RESULT) || !args->args[i])
+            continue;
+
+        std::string_view param(args->args[i], args->lengths[i]);
+        while (!param.empty())
+        {
+            auto amp = param.find('&');
+            auto kv = param.substr(0, amp);
+            param.remove_prefix((amp == std::string_view::npos) ?
+                param.size() : amp + 1);
+
+            auto eq = kv.find('=');
+            if ((eq != std::string_view::npos) &&
+                (kv.substr(0, eq) == order_by))
+            {
+                return kv.substr(eq + 1);
+            }
+        }
+    }
+
+    return std::string_view();
+}
+
+// транзакция запоминает ключ до отправки фрейма
+// в режиме affinity ключ выбирает дорожку
+void capstomp_order(capst::connection& conn, UDF_ARGS* args)
+{
+    if (conn.with_affinity())
+    {
+        conn.route(capstomp_order_key(conn.affinity(), args));
+        return;
+    }
+
+    if (conn.order_by().empty())
+        return;
+
+    auto key = capstomp_order_key(conn.order_by(), args);
+    if (!key.empty())
+        conn.order(key);
+}
+
+// тело фрейма ссылается на память аргументов
+stompconn::send capstomp_make_frame(bool json,
+    const capst::connection& conn, UDF_ARGS* args)
+{
+    stompconn::send frame(capstomp_destination(conn.destination(), args));
+    if (!capstomp_fill_headers(frame, args, 3))
+    {
+        if (json)
+            frame.push(stompconn::header::content_type_json());
+    }
+
+    stompconn::buffer payload;
+    payload.append_ref(args->args[2], args->lengths[2]);
+    frame.payload(std::move(payload));
+
+    return frame;
+}
+
+// если routing-key и заголовки известны в init
+// то есть переданы константами
+// собираем заготовку фрейма один раз на запрос
+// назначение берется из урла, фоновое подключение меняет его у соединения
+void capstomp_make_template(bool json, capstomp_context& ctx,
+    const btpro::uri& u, UDF_ARGS* args)
+{
+    auto arg_count = args->arg_count;
+    for (unsigned int i = 1; i < arg_count; ++i)
+    {
+        if ((i != 2) && !args->args[i])
+            return;
+    }
+
+    auto& frame = ctx.frame;
+    frame.assign(capstomp_destination(u.fragment(), args));
+    if (!capstomp_fill_headers(frame, args, 3))
+    {
+        if (json)
+            frame.push("content-type"sv, "application/json"sv);
+    }
+
+    capst_journal.trace([&]{
+        std::string text;
+        text.reserve(64);
+        text += "capstomp_init: frame template size="sv;
+        text += std::to_string(frame.head().size());
+        return text;
+    });
+}
+
+// подключение init откладывается до первого фрейма
+// в режиме без ошибок неудача закрывает сокет
+// и дальше фреймы пропускает проверка сокета
+void capstomp_establish(capst::connection& conn)
+{
+    if (!conn.pending())
+        return;
+
+    try
+    {
+        conn.establish();
+    }
+    catch (const std::exception& e)
+    {
+        conn.close();
+
+        if (!conn.with_no_error())
+            throw;
+
+        capst_journal.cerr([&]{
+            return std::string(e.what());
+        });
+    }
+    catch (...)
+    {
+        conn.close();
+
+        if (!conn.with_no_error())
+            throw;
+    }
+}
+
+//             0        1                2             3
+// "capstomp(\"uri\", \"routing-key\", \"json-data\"[, param])"
+// "capstomp(\"uri\", \"routing-key\", \"json-data\"[, param])"
+// "capstomp_json(\"uri\", \"routing-key\", \"json-data\"[, param])"
+// "capstomp_json(\"uri\", \"routing-key\", \"json-data\"[, param])"
+my_bool capstomp_init_context(bool json, UDF_INIT* initid,
+    UDF_ARGS* args, char* msg)
+{
+    std::unique_ptr<capstomp_context> ctx;
+    capst::connection *conn = nullptr;
+
+    try
+    {
+        auto args_count = args->arg_count;
+        if ((args_count < 3) ||
+            (!((args->arg_type[0] == STRING_RESULT) &&
+               (args->arg_type[1] == STRING_RESULT) &&
+               (args->arg_type[2] == STRING_RESULT))))
+        {
+            strncpy(msg, "bad args type, use "
+                "capstomp(\"uri\", \"routing-key\", \"json-data\"[, param])",
+                MYSQL_ERRMSG_SIZE);
+            return 1;
+        }
+
+        std::string u(args->args[0], args->lengths[0]);
+        if (u.empty())
+        {
+            strncpy(msg, "empty uri, use "
+                "capstomp(\"uri\", \"routing-key\", \"json-data\"[, param])",
+                MYSQL_ERRMSG_SIZE);
+            return 1;
+        }
+
+        ctx = std::make_unique<capstomp_context>();
+
+        // btpro::uri понимает один адрес
+        // список узлов кластера передаем отдельно
+        std::string hosts;
+        u = capst::cluster::normalize(u, hosts);
+
+        // парсим урл
+        btpro::uri uri(u);
+
+        // вызов с session=<CONNECTION_ID()> идет в транзакцию сессии
+        auto session_id = capst::settings::create(uri).session();
+        ctx->session = capst::session::find(uri, hosts, session_id);
+        if (ctx->session)
+        {
+            ctx->conn = ctx->session->conn;
+            ctx->conn->start_deadline();
+
+            capstomp_make_template(json, *ctx, uri, args);
+
+            initid->ptr = reinterpret_cast<char*>(ctx.release());
+            initid->maybe_null = 0;
+            initid->const_item = 0;
+
+            return 0;
+        }
+
+        // получаем хранилище
+        auto& store = capst::store::inst();
+
+        // получаем пулл соединенией
+        conn = &store.get(uri, hosts, u);
+
+        // сохраняем
+        ctx->conn = conn;
+
+        // резервируем соединение, подключение ждет первой строки
+        // в асинхронном режиме подключается поток отправки пула
+        if (conn->with_async())
+            conn->connect_async(uri, u);
+        else if (conn->with_affinity())
+            conn->connect_affinity(uri, u);
+        else
+            conn->prepare(uri, u);
+
+        capstomp_make_template(json, *ctx, uri, args);
+
+        initid->ptr = reinterpret_cast<char*>(ctx.release());
+        initid->maybe_null = 0;
+        initid->const_item = 0;
+
+        return 0;
+    }
+    catch (const std::exception& e)
+    {
+        snprintf(msg, MYSQL_ERRMSG_SIZE, "%s", e.what());
+    }
+    catch (...)
+    {
+        strncpy(msg, ":*(", MYSQL_ERRMSG_SIZE);
+    }
+
+    if (conn)
+    {
+        // фоновое подключение еще может работать с сокетом
+        conn->abandon();
+
+        // закроем сокет, чтобы пометить коннект как не удачный
+        conn->close();
+        
+        // но не бдуем его отдавать в пул
+        if (conn->with_no_error())
+        {
+            initid->ptr = reinterpret_cast<char*>(ctx.release());
+            return 0;
+        }
+
+        // коммитим все зависящие от нас транзакции
+        // и возвращаем соединение в пулл
+        conn->commit();
+    }
+
+    capst_journal.cout([&]{
+        std::string text;
+        text += "capstomp_init: 1"sv;
+        return text;
+    });
+    return 1;
+}
+
+extern "C" my_bool capstomp_init(UDF_INIT* initid,
+    UDF_ARGS* args, char* msg)
+{
+    return capstomp_init_context(false, initid, args, msg);
+}
+
 //             0        1                2             3
 // "capstomp(\"uri\", \"routing-key\", \"json-data\"[, param])"
 // "capstomp(\"uri\", \"routing-key\", \"json-data\"[, param])"
@@ -272,15 +495,22 @@ bool capstomp_fill_headers(stompconn::send& frame,
 long long capstomp_content(bool json, UDF_INIT* initid, UDF_ARGS* args,
                    char* is_null, char* error)
 {
-    auto conn = reinterpret_cast<capst::connection*>(initid->ptr);
+    auto ctx = reinterpret_cast<capstomp_context*>(initid->ptr);
+    auto conn = ctx->conn;
 #ifdef CAPSTOMP_STATE_DEBUG
     conn->set_state(5);
 #endif
     try
     {
+        capstomp_establish(*conn);
+
+        // срок отсчитывается заново на каждый вызов
+        conn->start_deadline();
+
         // если сокет закрыт
         // значит режим без ошибок
-        if (!conn->good() && conn->with_no_error())
+        if (!conn->good() && !conn->with_async() &&
+            !conn->with_affinity() && conn->with_no_error())
         {
             // просто выходим
             *is_null = 0;
@@ -288,24 +518,7 @@ long long capstomp_content(bool json, UDF_INIT* initid, UDF_ARGS* args,
             return 0;
         }
 
-        std::string destination(conn->destination());
-        std::string_view routing_key(args->args[1], args->lengths[1]);
-        if (!routing_key.empty())
-        {
-            destination += '/';
-            destination += routing_key;
-        }
-
-        stompconn::send frame(destination);
-        if (!capstomp_fill_headers(frame, args, 3))
-        {
-            if (json)
-                frame.push(stompconn::header::content_type_json());
-        }
-
-        stompconn::buffer payload;
-        payload.append_ref(args->args[2], args->lengths[2]);
-        frame.payload(std::move(payload));
+        capstomp_order(*conn, args);
 
 #ifdef CAPSTOMP_STAPPE_TEST
         // это для теста медленного триггера
@@ -322,6 +535,18 @@ long long capstomp_content(bool json, UDF_INIT* initid, UDF_ARGS* args,
         throw std::runtime_error("capstomp throw test");
 #endif
 
+        // по заготовке отправляем только тело
+        // квитанции требуют полного фрейма
+        if (!ctx->frame.empty() && !conn->with_receipt() &&
+            !conn->with_affinity())
+        {
+            std::string_view body(args->args[2], args->lengths[2]);
+            return static_cast<long long>(
+                conn->send_content(ctx->frame, body));
+        }
+
+        auto frame = capstomp_make_frame(json, *conn, args);
+
         return static_cast<long long>(conn->send_content(std::move(frame)));
     }
     catch (const std::exception& e)
@@ -347,12 +572,26 @@ long long capstomp_content(bool json, UDF_INIT* initid, UDF_ARGS* args,
 
 extern "C" void capstomp_deinit(UDF_INIT* initid)
 {
+    auto ctx = reinterpret_cast<capstomp_context*>(initid->ptr);
+
+    // соединение сессии остается за ней до capstomp_commit
+    if (ctx->session)
+    {
+        capst::session::leave(ctx->session);
+        delete ctx;
+        return;
+    }
+
     try
     {
-        auto conn = reinterpret_cast<capst::connection*>(initid->ptr);
+        auto conn = ctx->conn;
 #ifdef CAPSTOMP_STATE_DEBUG
         conn->set_state(7);
 #endif
+        // фоновое подключение пишет срок, ждем его до отсчета
+        conn->abandon();
+        conn->start_deadline();
+
         // возможно, это уничтожит этот объект соединения
         conn->commit();
     }
@@ -368,12 +607,14 @@ extern "C" void capstomp_deinit(UDF_INIT* initid)
             return ":*(";
         });
     }
+
+    delete ctx;
 }
 
 extern "C" my_bool capstomp_json_init(UDF_INIT* initid,
     UDF_ARGS* args, char* msg)
 {
-    return capstomp_init(initid, args, msg);
+    return capstomp_init_context(true, initid, args, msg);
 }
 
 extern "C" long long capstomp(UDF_INIT* initid,
@@ -393,5 +634,182 @@ extern "C" void capstomp_json_deinit(UDF_INIT* initid)
     capstomp_deinit(initid);
 }
 
+//                   0        1                2             3
+// "capstomp_batch(\"uri\", \"routing-key\", \"json-data\"[, param])"
+// "capstomp_batch_json(\"uri\", \"routing-key\", \"json-data\"[, param])"
+extern "C" my_bool capstomp_batch_init(UDF_INIT* initid,
+    UDF_ARGS* args, char* msg)
+{
+    return capstomp_init_context(false, initid, args, msg);
+}
+
+extern "C" void capstomp_batch_clear(UDF_INIT* initid, char*, char*)
+{
+    auto ctx = reinterpret_cast<capstomp_context*>(initid->ptr);
+    // прошлая группа отдана в отправку вместе с буфером
+    ctx->data.clear();
+    ctx->count = 0;
+    ctx->last = 0;
+    ctx->sent = 0;
+    ctx->error = false;
+}
+
+void capstomp_batch_content_add(bool json, UDF_INIT* initid, UDF_ARGS* args)
+{
+    auto ctx = reinterpret_cast<capstomp_context*>(initid->ptr);
+    auto conn = ctx->conn;
+    try
+    {
+        // заголовки фрейма зависят от транзакции
+        capstomp_establish(*conn);
+
+        // режим без ошибок и соединения нет
+        if (!conn->good() && !conn->with_async() &&
+            !conn->with_affinity() && conn->with_no_error())
+            return;
+
+        capstomp_order(*conn, args);
+
+        // строки разных ключей уходят по своим дорожкам сразу
+        if (conn->with_affinity())
+        {
+            ctx->sent += conn->send_content(
+                capstomp_make_frame(json, *conn, args));
+            return;
+        }
+
+        // фрейм копируется целиком
+        // память аргументов перезаписывается на каждой строке
+        ctx->last = ctx->data.size();
+        if (!ctx->frame.empty())
+        {
+            std::string_view body(args->args[2], args->lengths[2]);
+            conn->append_content(ctx->data, ctx->frame, body);
+        }
+        else
+            ctx->data += conn->make_content(capstomp_make_frame(json, *conn, args));
+
+        ++ctx->count;
+        return;
+    }
+    catch (const std::exception& e)
+    {
+        capst_journal.cerr([&]{
+            return std::string(e.what());
+        });
+    }
+    catch (...)
+    {
+        capst_journal.cerr([&]{
+            return ":*(";
+        });
+    }
+
+    ctx->error = true;
+}
+
+// отправляем все фреймы группы одной записью в сокет
+long long capstomp_batch_content(UDF_INIT* initid,
+    char* is_null, char* error)
+{
+    auto ctx = reinterpret_cast<capstomp_context*>(initid->ptr);
+    auto conn = ctx->conn;
+    try
+    {
+        // если сокет закрыт
+        // значит режим без ошибок
+        if (!conn->good() && !conn->with_async() &&
+            !conn->with_affinity() && conn->with_no_error())
+        {
+            // просто выходим
+            *is_null = 0;
+            *error = 0;
+            return 0;
+        }
+
+        if (ctx->error)
+            throw std::runtime_error("capstomp_batch: frame error");
+
+        conn->start_deadline();
+
+        *is_null = 0;
+
+        if (conn->with_affinity())
+            return static_cast<long long>(std::exchange(ctx->sent, 0));
+
+        if (!ctx->count)
+            return 0;
+
+        auto count = ctx->count;
+        ctx->count = 0;
+
+        return static_cast<long long>(
+            conn->send_content(std::move(ctx->data), count, ctx->last));
+    }
+    catch (const std::exception& e)
+    {
+        capst_journal.cerr([&]{
+            return std::string(e.what());
+        });
+    }
+    catch (...)
+    {
+        capst_journal.cerr([&]{
+            return ":*(";
+        });
+    }
+
+    *is_null = 0;
+    *error = 1;
+
+    conn->close();
+
+    return 0;
+}
+
+extern "C" void capstomp_batch_add(UDF_INIT* initid,
+    UDF_ARGS* args, char*, char*)
+{
+    capstomp_batch_content_add(false, initid, args);
+}
+
+extern "C" long long capstomp_batch(UDF_INIT* initid,
+    UDF_ARGS*, char* is_null, char* error)
+{
+    return capstomp_batch_content(initid, is_null, error);
+}
+
+extern "C" void capstomp_batch_deinit(UDF_INIT* initid)
+{
+    // коммит транзакции и возврат соединения в пул
+    capstomp_deinit(initid);
+}
+
+extern "C" my_bool capstomp_batch_json_init(UDF_INIT* initid,
+    UDF_ARGS* args, char* msg)
+{
+    return capstomp_init_context(true, initid, args, msg);
+}
+
+extern "C" void capstomp_batch_json_clear(UDF_INIT* initid,
+    char* is_null, char* error)
+{
+    capstomp_batch_clear(initid, is_null, error);
+}
 
+extern "C" void capstomp_batch_json_add(UDF_INIT* initid,
+    UDF_ARGS* args, char*, char*)
+{
+    capstomp_batch_content_add(true, initid, args);
+}
 
+extern "C" long long capstomp_batch_json(UDF_INIT* initid,
+    UDF_ARGS*, char* is_null, char* error)
+{
+    return capstomp_batch_content(initid, is_null, error);
+}
+
+extern "C" void capstomp_batch_json_deinit(UDF_INIT* initid)
+{
+    capstomp_batch_deinit(initid);
+}